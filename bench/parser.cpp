@@ -0,0 +1,100 @@
+//request parser microbenchmark, run with "make bench"
+//the header sets are what the workers receive behind the ingress proxies: a browser page load, a SPA API call with a JSON body,
+//a GET with query string parameters and the load balancer health check, each figure is the best of 7 runs
+#include "httputils.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+	struct sample {
+		const char* name;
+		std::string payload;
+	};
+
+	const std::string proxy_headers {
+		"X-Forwarded-For: 203.0.113.54, 10.42.0.17\r\n"
+		"X-Forwarded-Proto: https\r\n"
+		"X-Forwarded-Host: app.example.com\r\n"
+		"X-Forwarded-Port: 443\r\n"
+		"X-Real-IP: 203.0.113.54\r\n"
+		"X-Request-ID: 7f3c2a9e4b1d4c7a9e2f6b8d1a3c5e7f\r\n"
+	};
+
+	const std::string browser_headers {
+		"Host: app.example.com\r\n"
+		"Connection: keep-alive\r\n"
+		"sec-ch-ua: \"Chromium\";v=\"128\", \"Not;A=Brand\";v=\"24\", \"Google Chrome\";v=\"128\"\r\n"
+		"sec-ch-ua-mobile: ?0\r\n"
+		"sec-ch-ua-platform: \"Windows\"\r\n"
+		"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36\r\n"
+		"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+		"Accept-Language: es-VE,es;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+		"Sec-Fetch-Site: same-origin\r\n"
+		"Sec-Fetch-Mode: cors\r\n"
+		"Sec-Fetch-Dest: empty\r\n"
+		"Referer: https://app.example.com/gastos/index.html\r\n"
+		"Cookie: _ga=GA1.1.1843762112.1728000000; CPPSESSIONID=4b1d4c7a-9e2f-6b8d-1a3c-5e7f7f3c2a9e; _ga_XYZ=GS1.1.1728000000.3.1.1728000100.0.0.0\r\n"
+	};
+
+	std::vector<sample> get_samples()
+	{
+		std::vector<sample> samples;
+		samples.push_back({"page load",
+			"GET /gastos/index.html HTTP/1.1\r\n" + browser_headers
+			+ "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+			+ "Upgrade-Insecure-Requests: 1\r\n"
+			+ "If-None-Match: \"1f3c-65a8b2c4\"\r\n"
+			+ "If-Modified-Since: Sat, 12 Oct 2026 18:24:03 GMT\r\n"
+			+ proxy_headers + "\r\n"});
+		samples.push_back({"query string",
+			"GET /ms/gasto/search?fecha1=2026-01-01&fecha2=2026-10-19&categ_id=7&motivo=caf%C3%A9+con+leche&monto=12.50 HTTP/1.1\r\n"
+			+ browser_headers + "Accept: application/json\r\n"
+			+ "Origin: https://app.example.com\r\n" + proxy_headers + "\r\n"});
+		const std::string body {R"({"fecha": "2026-10-19", "categ_id": 7, "monto": 12.5, "motivo": "almuerzo con el equipo"})"};
+		samples.push_back({"api post",
+			"POST /ms/gasto/add HTTP/1.1\r\n" + browser_headers + "Accept: application/json\r\n"
+			+ "Content-Type: application/json\r\n" + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+			+ "Origin: https://app.example.com\r\n" + proxy_headers + "\r\n" + body});
+		samples.push_back({"health check",
+			"GET /ms/ping HTTP/1.1\r\nHost: 10.42.0.17:8080\r\nUser-Agent: kube-probe/1.30\r\nAccept: */*\r\nConnection: close\r\n\r\n"});
+		return samples;
+	}
+
+	//the headers the microservice engine reads for every request
+	size_t read_headers(const http::request& req) noexcept
+	{
+		return req.get_header(http::header::x_request_id).size() + req.get_header(http::header::accept_encoding).size()
+			+ req.get_header(http::header::if_none_match).size() + req.get_header(http::header::content_type).size();
+	}
+}
+
+int main()
+{
+	constexpr int iterations {100000};
+	constexpr int runs {7};
+	std::printf("scan kernel: %s\n", std::string(scan::get_kernel_name()).c_str());
+	size_t check {0};
+	for (const auto& s: get_samples()) {
+		http::request req(0, "127.0.0.1");
+		double best {0};
+		for (int r = 0; r < runs; r++) {
+			const auto start {std::chrono::steady_clock::now()};
+			for (int i = 0; i < iterations; i++) {
+				req.clear();
+				req.payload.append(s.payload);
+				req.parse();
+				check += read_headers(req) + req.params.size();
+			}
+			const std::chrono::duration<double, std::nano> elapsed {std::chrono::steady_clock::now() - start};
+			const double ns {elapsed.count() / iterations};
+			if (r == 0 || ns < best)
+				best = ns;
+		}
+		if (req.errcode != 0)
+			std::printf("%-14s parse error: %s\n", s.name, req.errmsg.c_str());
+		std::printf("%-14s %5zu bytes %8.0f ns/request\n", s.name, s.payload.size(), best);
+	}
+	return check == 0;
+}
@@ -4,9 +4,11 @@ namespace audit
 {
 	const std::string LOGGER_SRC {"audit"};
 	
-	void save(const std::string& path, const std::string& user_login, const std::string& ip_address, config::microService& ms) noexcept
+	void save(const std::string& path, const std::string& user_login, const std::string& ip_address, const config::microService& ms, const config::requestParameters& params, size_t rows) noexcept
 	{
-		std::string record {ms.reqParams.get_audit_msg(ms.audit_record)};
+		std::string record {params.get_audit_msg(ms.audit_template, user_login)};
+		if (rows > 1)
+			record.append(" rows: ").append(std::to_string(rows));
 		logger::log(LOGGER_SRC, "info", "path: " + path + " user: " + user_login + " remote-ip: " + ip_address + " " + record, true);
 	}
 }
@@ -16,7 +16,8 @@
 
 namespace audit
 {
-	void save(const std::string& path, const std::string& user_login, const std::string& ip_address, config::microService& ms) noexcept;
+	//rows > 1 is a bulk request recorded once with the values of one of its rows
+	void save(const std::string& path, const std::string& user_login, const std::string& ip_address, const config::microService& ms, const config::requestParameters& params, size_t rows = 1) noexcept;
 }
 
 #endif /* AUDIT_H_ */
@@ -3,13 +3,166 @@
 namespace config 
 {
 	const std::string LOGGER_SRC {"config"};
-	static std::unordered_map<std::string, microService> m_services;
+	static service_map m_services;
+	static cors_config m_cors;
+	static listen_config m_listen;
 	
-	std::unordered_map<std::string, microService> get_config_map() noexcept
+	const service_map& get_config_map() noexcept
 	{
 		return m_services;
 	}
 
+	const cors_config& get_cors() noexcept
+	{
+		return m_cors;
+	}
+
+	const listen_config& get_listen() noexcept
+	{
+		return m_listen;
+	}
+
+	text_template::text_template(std::string_view text, const std::vector<inputParam>& params): source{text}
+	{
+		constexpr std::string_view login {"userlogin"};
+		size_t start {0};
+		for (size_t pos = source.find('$'); pos != std::string::npos; pos = source.find('$', pos + 1)) {
+			const std::string_view name {std::string_view(source).substr(pos + 1)};
+			int slot {none};
+			size_t length {0};
+			if (name.starts_with(login)) {
+				slot = userlogin;
+				length = login.size();
+			} else {
+				for (size_t i = 0; i < params.size(); i++) {
+					if (params[i].name.size() > length && name.starts_with(params[i].name)) {
+						slot = i;
+						length = params[i].name.size();
+					}
+				}
+			}
+			if (slot == none)
+				continue;
+			parts.push_back({start, pos - start, slot});
+			start = pos + 1 + length;
+			pos = start - 1;
+		}
+		parts.push_back({start, source.size() - start, none});
+	}
+
+	prepared_template::prepared_template(const text_template& t)
+	{
+		static int statements {0};
+		name = "cpp_stmt_" + std::to_string(++statements);
+		sql.reserve(t.source.size());
+		for (const auto& p: t.parts) {
+			sql.append(t.source, p.offset, p.length);
+			if (p.slot == text_template::none)
+				continue;
+			auto it {std::ranges::find(slots, p.slot)};
+			if (it == slots.end())
+				it = slots.insert(slots.end(), p.slot);
+			placeholders.push_back(sql.size());
+			sql.append("$").append(std::to_string(it - slots.begin() + 1));
+		}
+	}
+
+	bool split_statements(std::string_view sql, std::vector<std::string_view>& statements)
+	{
+		const auto is_word = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$'; };
+		const size_t n {sql.size()};
+		size_t start {0};
+		bool code {false}; //the statement has something besides blanks and comments
+		size_t i {0};
+		while (i < n) {
+			const char c {sql[i]};
+			const char next {(i + 1 < n) ? sql[i + 1] : '\0'};
+			if (c == ';') {
+				if (code)
+					statements.push_back(sql.substr(start, i - start));
+				start = ++i;
+				code = false;
+			} else if (c == '-' && next == '-') {
+				i = std::min(sql.find('\n', i), n);
+			} else if (c == '/' && next == '*') { //block comments nest
+				int depth {0};
+				do {
+					if (i + 1 >= n)
+						return false;
+					if (sql[i] == '/' && sql[i + 1] == '*') {
+						depth++;
+						i += 2;
+					} else if (sql[i] == '*' && sql[i + 1] == '/') {
+						depth--;
+						i += 2;
+					} else
+						i++;
+				} while (depth > 0);
+			} else if (std::isspace(static_cast<unsigned char>(c))) {
+				i++;
+			} else if (c == '\'' || c == '"') { //a doubled quote is part of the text, E'' strings also escape with backslash
+				code = true;
+				const bool backslash {c == '\'' && i > 0 && (sql[i - 1] == 'E' || sql[i - 1] == 'e') && (i == 1 || !is_word(sql[i - 2]))};
+				size_t j {i + 1};
+				while (true) {
+					if (j >= n)
+						return false;
+					if (backslash && sql[j] == '\\')
+						j += 2;
+					else if (sql[j] == c && j + 1 < n && sql[j + 1] == c)
+						j += 2;
+					else if (sql[j] == c)
+						break;
+					else
+						j++;
+				}
+				i = j + 1;
+			} else if (c == '$' && (i == 0 || !is_word(sql[i - 1])) && !std::isdigit(static_cast<unsigned char>(next))) { //$tag$ body $tag$
+				code = true;
+				size_t j {i + 1};
+				while (j < n && (std::isalnum(static_cast<unsigned char>(sql[j])) || sql[j] == '_'))
+					j++;
+				if (j < n && sql[j] == '$') {
+					const std::string_view tag {sql.substr(i, j - i + 1)};
+					const size_t end {sql.find(tag, j + 1)};
+					if (end == std::string_view::npos)
+						return false;
+					i = end + tag.size();
+				} else
+					i = j;
+			} else {
+				code = true;
+				i++;
+			}
+		}
+		if (code)
+			statements.push_back(sql.substr(start));
+		return true;
+	}
+
+	//a prepared statement holds a single statement, dbgetm runs each one on its own and returns an array per statement,
+	//the other services keep sending sql with several statements as text
+	void prepare_statements(microService& m, const std::string& uri)
+	{
+		if (!m.validatorConfig.sql.empty())
+			m.validatorConfig.statement = prepared_template(m.validatorConfig.sql_template);
+		if (m.func_service == "dbcopy") //COPY cannot be prepared
+			return;
+		std::vector<std::string_view> queries;
+		if (!split_statements(m.sql, queries)) {
+			if (m.func_service == "dbgetm")
+				throw std::runtime_error("dbgetm sql has an unterminated quote, dollar-quoted body or comment, uri: " + uri);
+			logger::log(LOGGER_SRC, "warn", "sql has an unterminated quote or comment and will not be prepared, uri: " + uri);
+			return;
+		}
+		if (queries.size() > 1 && m.func_service != "dbgetm") {
+			logger::log(LOGGER_SRC, "warn", "sql has several statements and will not be prepared, uri: " + uri);
+			return;
+		}
+		for (const auto q: queries)
+			m.statements.emplace_back(text_template(q, m.params));
+	}
+
 	struct line_reader {
 	  public:
 		bool eof() { return _eof; }
@@ -69,6 +222,11 @@ namespace config
 		auto pos {s.find(key)};
 		if (pos != std::string::npos) {
 			pos += key.size();
+			//unquoted number or boolean
+			if (auto start = s.find_first_not_of(" ", pos); start != std::string::npos && s[start] != '"') {
+				auto end {s.find_first_of(",} ", start)};
+				return s.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+			}
 			auto pos1 {s.find("\"", pos)};
 			if (pos1 != std::string::npos) {
 				auto pos2 {s.find("\"", pos1 + 1)};
@@ -101,6 +259,28 @@ namespace config
 		return items;
 	}
 
+	//"name": ["a", "b"]
+	std::vector<std::string> get_array(std::string_view s, const std::string& name)
+	{
+		std::vector<std::string> items;
+		auto pos {s.find("\"" + name + "\":")};
+		if (pos == std::string::npos)
+			return items;
+		pos = s.find("[", pos);
+		const auto end {s.find("]", pos)};
+		if (pos == std::string::npos || end == std::string::npos)
+			return items;
+		const std::string_view list {s.substr(pos + 1, end - pos - 1)};
+		for (auto pos1 = list.find("\""); pos1 != std::string::npos; pos1 = list.find("\"", pos1 + 1)) {
+			const auto pos2 {list.find("\"", pos1 + 1)};
+			if (pos2 == std::string::npos)
+				break;
+			items.emplace_back(list.substr(pos1 + 1, pos2 - pos1 - 1));
+			pos1 = pos2;
+		}
+		return items;
+	}
+
 	void parse() {
 		try {
 			logger::log(LOGGER_SRC, "info", "parsing /etc/cppserver/config.json");
@@ -136,10 +316,29 @@ namespace config
 							m.func_service = get_value(s);
 						if (s.starts_with("\t\t\t\"secure\":"))
 							m.secure = (get_value(s) == "0") ? false : true;
+						if (s.starts_with("\t\t\t\"stream\":"))
+							m.stream = (get_value(s) == "true") ? true : false;
+						if (s.starts_with("\t\t\t\"compress\":"))
+							m.compress = (get_value(s) == "false") ? false : true;
+						if (s.starts_with("\t\t\t\"etag\":"))
+							m.etag = (get_value(s) == "true") ? true : false;
+						if (s.starts_with("\t\t\t\"coalesce\":"))
+							m.coalesce = (get_value(s) == "true") ? true : false;
+						if (s.starts_with("\t\t\t\"refresh_ms\":"))
+							m.refresh_ms = std::stoul(std::string(get_value(s)));
+						if (s.starts_with("\t\t\t\"cache\":")) {
+							if (s.contains("\"ttl_ms\":"))
+								m.cache.ttl_ms = std::stoul(std::string(get_attribute(s, "ttl_ms")));
+							if (s.contains("\"per_user\":"))
+								m.cache.per_user = (get_attribute(s, "per_user") == "true") ? true : false;
+							m.cache.keys = get_array(s, "keys");
+						}
+						if (s.starts_with("\t\t\t\"invalidates\":"))
+							m.invalidates = get_array(s, "invalidates");
 						if (s.starts_with("\t\t}"))
 							break;
 						if (s.starts_with("\t\t\t\"fields\":")) {
-							std::vector<requestParameters::inputParam> params;
+							std::vector<inputParam>& params {m.params};
 							params.reserve(10);
 							std::string name{""}, type{""}, required{""};
 							while (true) 
@@ -160,7 +359,6 @@ namespace config
 								else throw std::runtime_error("Invalid data type in config.json: " + type + " uri: " + uri + " line: " + std::to_string(lr.get_line_number()));
 								params.emplace_back(name, (required=="true"), dt);						
 							}
-							m.reqParams.set_params(params);
 						}
 						if (s.starts_with("\t\t\t\"validator\":")) {
 								if (s.contains("\"function\":")) 
@@ -206,8 +404,45 @@ namespace config
 							}
 						}
 					}
+					//path template parameters like {id} are bound to the input field with the same name
+					for (auto pos = uri.find('{'); pos != std::string::npos; pos = uri.find('{', pos + 1)) {
+						const std::string name {uri.substr(pos + 1, uri.find('}', pos) - pos - 1)};
+						if (std::ranges::none_of(m.params, [&name](const inputParam& p) { return p.name == name; }))
+							throw std::runtime_error("path parameter {" + name + "} is not declared in fields, uri: " + uri);
+					}
+					//the same response is served to every request, it cannot depend on inputs
+					if (m.func_service == "snapshot" && (m.refresh_ms == 0 || !m.params.empty()))
+						throw std::runtime_error("snapshot service requires refresh_ms and cannot declare fields, uri: " + uri);
+					m.sql_template = text_template(m.sql, m.params);
+					m.validatorConfig.sql_template = text_template(m.validatorConfig.sql, m.params);
+					m.audit_template = text_template(m.audit_record, m.params);
+					prepare_statements(m, uri);
 					m_services.emplace(uri, m);
 				}
+				if (s.starts_with("\t\"cors\":")) {
+					while (true) {
+						auto s = lr.getline();
+						if (lr.eof() || s.starts_with("\t}"))
+							break;
+						if (s.starts_with("\t\t\"allow_methods\":"))
+							m_cors.allow_methods = get_value(s);
+						if (s.starts_with("\t\t\"allow_headers\":"))
+							m_cors.allow_headers = get_value(s);
+						if (s.starts_with("\t\t\"max_age\":"))
+							m_cors.max_age = std::stoul(std::string(get_value(s)));
+					}
+				}
+				if (s.starts_with("\t\"listen\":")) {
+					while (true) {
+						auto s = lr.getline();
+						if (lr.eof() || s.starts_with("\t}"))
+							break;
+						if (s.starts_with("\t\t\"db\":"))
+							m_listen.db = get_value(s);
+						if (s.starts_with("\t\t\"channels\":"))
+							m_listen.channels = get_array(s, "channels");
+					}
+				}
 			}				
 			
 			for (auto& s: m_services)
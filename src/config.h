@@ -14,6 +14,8 @@
 #include <string_view>
 #include <unordered_map>
 #include <vector>
+#include <ranges>
+#include <algorithm>
 #include <functional>
 #include <sstream>
 #include <fstream>
@@ -30,116 +32,180 @@ namespace config
 							FIELD_DATE = 4 //yyyy-mm-dd
 						};
 
+	//input field declared for a service in config.json
+	struct inputParam {
+		std::string name;
+		bool required;
+		inputFieldType datatype;
+		inputParam(std::string n, bool r, inputFieldType d): name{n}, required{r}, datatype{d} {  }
+	};
+
+	//text with $name references to the input fields, compiled once into literal runs and slots so it can be
+	//rendered in a single pass, after a '$' the longest field name that matches wins ($date1 before $date)
+	struct text_template {
+		static constexpr int userlogin {-1};
+		static constexpr int none {-2};
+		struct part {
+			size_t offset; //literal text in source that precedes the slot
+			size_t length;
+			int slot; //index of the input field, userlogin, or none for the trailing text
+		};
+		std::string source;
+		std::vector<part> parts;
+		text_template() = default;
+		text_template(std::string_view text, const std::vector<inputParam>& params);
+	};
+
+	//a single SQL statement with every distinct slot of its template replaced by a $1..$n placeholder,
+	//executed as a server-side prepared statement
+	struct prepared_template {
+		std::string name; //statement name, unique in the process
+		std::string sql;
+		std::vector<int> slots; //slot bound to each placeholder
+		std::vector<size_t> placeholders; //offset in sql of every $n, to splice the values if it cannot be prepared
+		prepared_template() = default;
+		explicit prepared_template(const text_template& t);
+	};
+
+	//statements of sql split on the ';' that are outside strings, quoted identifiers, dollar-quoted bodies and comments,
+	//statements with only blanks or comments are skipped, false if a quote or a comment is not closed
+	bool split_statements(std::string_view sql, std::vector<std::string_view>& statements);
+
+	//values of the input fields of the request being processed, bound to the field list of its service,
+	//each worker thread owns one and reuses it for every request
 	struct requestParameters {
 
 		public:
 
-			struct inputParam {
-				std::string name;
-				bool required;
-				inputFieldType datatype;
-				std::string value;
-				inputParam(std::string n, bool r, inputFieldType d): name{n}, required{r}, datatype{d}, value{""} {  }
-			};
-
 			requestParameters() {}
 
-			inline std::string get(const std::string& name) const 
+			inline void bind(const std::vector<inputParam>& fields) 
+			{
+				params = &fields;
+				values.resize(fields.size());
+				for (auto& v: values) 
+					v.clear();
+			}
+
+			inline const std::string& get(const std::string& name) const 
 			{
-				for (const inputParam& p:params) if (p.name==name) return p.value;
+				for (size_t i = 0; i < params->size(); i++) if ((*params)[i].name==name) return values[i];
 				throw std::runtime_error("requestParameters.get: parameter not found: " + name);
 			}
 
 			inline void set(const std::string& name, const std::string& value) 
 			{
-				for (inputParam& p:params) if (p.name==name) { p.value = value; return;}
+				for (size_t i = 0; i < params->size(); i++) if ((*params)[i].name==name) { values[i] = value; return;}
 				throw std::runtime_error("requestParameters.set: parameter not found: " + name);
 			}
 
-			inline std::vector<inputParam>& list() 
+			inline const std::vector<inputParam>& list() const 
 			{
-				return params;
+				return *params;
+			}
+
+			inline std::string& value(size_t i) 
+			{
+				return values[i];
+			}
+
+			//values quoted for SQL, empty values as NULL
+			inline std::string sql(const text_template& t, const std::string& userlogin = "Undefined") const 
+			{
+				return render(t, mode::sql, userlogin);
 			}
 
 			inline std::string sql(const std::string& sqlTemplate, const std::string& userlogin = "Undefined") const 
 			{
-				std::string sql = sqlTemplate;
-				if (std::size_t pos = sql.find("$userlogin"); pos != std::string::npos)
-					sql.replace(pos, std::string("$userlogin").length(), "'" + userlogin + "'");
-				for (const auto& p : params) 
-				{
-					std::string paramName = "$" + p.name;
-					while (true) 
-					{
-						if (std::size_t pos = sql.find(paramName); pos != std::string::npos) {
-							if (p.value.empty()) {
-								sql.replace(pos, paramName.length(), "NULL");
-								continue;
-							}
-							switch (p.datatype) {
-								case inputFieldType::FIELD_INTEGER:
-								case inputFieldType::FIELD_DOUBLE:
-									sql.replace(pos, paramName.length(), p.value);
-									break;
-								default:
-									sql.replace(pos, paramName.length(), "'" + p.value + "'");
-									break;
-							}
-						} else
-							break;
-					}
-				}
-				return sql;
+				return render(text_template(sqlTemplate, *params), mode::sql, userlogin);
 			}
 
-			inline std::string get_audit_msg(const std::string& audit_template) const 
+			inline std::string get_audit_msg(const text_template& t, const std::string& userlogin) const 
 			{
-				std::string record = audit_template;
-				for (const auto& p : params) 
-				{
-					std::string paramName = "$" + p.name;
-					while (true) 
-					{
-						if (std::size_t pos = record.find(paramName); pos != std::string::npos) {
-							if (p.value.empty()) 
-								record.replace(pos, paramName.length(), "NULL");
-							else
-								record.replace(pos, paramName.length(), p.value);
-						} else
-							break;
-					}
-				}
-				return record;
+				return render(t, mode::audit, userlogin);
 			}
 			
-			//email body
-			inline std::string get_body(std::string body, const std::string& userlogin = "Undefined") const 
+			//values for the placeholders of a prepared statement in text format, nullptr is NULL
+			inline std::vector<const char*> get_values(const prepared_template& st, const std::string& userlogin) const 
 			{
-				if (std::size_t pos = body.find("$userlogin"); pos != std::string::npos)
-					body.replace(pos, std::string("$userlogin").length(), userlogin);
-				for (const auto& p : params) 
-				{
-					std::string paramName = "$" + p.name;
-					while (true) 
-					{
-						if (std::size_t pos = body.find(paramName); pos != std::string::npos) {
-							if (p.value.empty()) 
-								body.replace(pos, paramName.length(), "");
-							else
-								body.replace(pos, paramName.length(), p.value);
-						} else
-							break;
-					}
+				std::vector<const char*> result;
+				result.reserve(st.slots.size());
+				for (const int slot: st.slots) {
+					if (slot == text_template::userlogin)
+						result.push_back(userlogin.c_str());
+					else
+						result.push_back(values[slot].empty() ? nullptr : values[slot].c_str());
 				}
-				return body;
+				return result;
 			}
-			
-			void set_params(std::vector<inputParam> p) noexcept
+
+			//email body
+			inline std::string get_body(const std::string& body, const std::string& userlogin = "Undefined") const 
 			{
-				params = p;
+				return render(text_template(body, *params), mode::text, userlogin);
 			}
+			
 		private:
-			std::vector<inputParam> params;
+			static inline const std::vector<inputParam> no_params {};
+			const std::vector<inputParam>* params {&no_params};
+			std::vector<std::string> values;
+
+			enum class mode {sql, audit, text};
+
+			inline void append_value(std::string& out, int slot, mode m, const std::string& userlogin) const 
+			{
+				if (slot == text_template::userlogin) {
+					if (m == mode::sql)
+						append_literal(out, userlogin);
+					else
+						out.append(userlogin);
+					return;
+				}
+				const std::string& value {values[slot]};
+				if (value.empty()) {
+					if (m != mode::text)
+						out.append("NULL");
+					return;
+				}
+				const inputFieldType type {(*params)[slot].datatype};
+				if (m == mode::sql && type != inputFieldType::FIELD_INTEGER && type != inputFieldType::FIELD_DOUBLE)
+					append_literal(out, value);
+				else
+					out.append(value);
+			}
+
+			//quoted SQL string literal, values are stored as received because prepared statements do not need escaping
+			inline void append_literal(std::string& out, const std::string& value) const 
+			{
+				out.push_back('\'');
+				for (const char c: value) {
+					if (c == '\\')
+						continue;
+					if (c == '\'')
+						out.push_back('\'');
+					out.push_back(c);
+				}
+				out.push_back('\'');
+			}
+
+			inline std::string render(const text_template& t, mode m, const std::string& userlogin) const 
+			{
+				size_t size {t.source.size()};
+				for (const auto& p: t.parts) {
+					if (p.slot == text_template::userlogin)
+						size += userlogin.size() + 2;
+					else if (p.slot >= 0)
+						size += values[p.slot].size() + 4;
+				}
+				std::string out;
+				out.reserve(size);
+				for (const auto& p: t.parts) {
+					out.append(t.source, p.offset, p.length);
+					if (p.slot != text_template::none)
+						append_value(out, p.slot, m, userlogin);
+				}
+				return out;
+			}
 
 	};
 	
@@ -148,20 +214,36 @@ namespace config
 		std::string db;
 		std::string sql;
 		bool secure {true};
-		requestParameters reqParams;
+		bool stream {false}; //send rows using chunked transfer-encoding as they are fetched
+		bool compress {true}; //gzip/deflate the response if the client accepts it
+		bool etag {false}; //weak ETag of the response, 304 Not Modified if If-None-Match matches
+		bool coalesce {false}; //identical concurrent queries run once and share the response
+		unsigned long refresh_ms {0}; //"snapshot" services: interval of the background query that rebuilds the response
+		struct cache_config {
+			unsigned long ttl_ms {0}; //0 disables the result cache for the service
+			bool per_user {false}; //the user login is part of the key
+			std::vector<std::string> keys; //invalidation tags, "tags" already names the arrays of dbgetm
+		} cache;
+		std::vector<std::string> invalidates; //cache keys dropped when the service succeeds
+		std::vector<inputParam> params; //input fields
+		text_template sql_template; //sql compiled against params
+		std::vector<prepared_template> statements; //one per statement of sql, empty if it cannot be prepared
 		std::vector<std::string> varNames; //array names when returning multiple arrays
 		std::vector<std::string> roleNames; //authorized roles
 		struct validator {
 			std::string sql;
+			text_template sql_template;
+			prepared_template statement;
 			std::string id;
 			std::string description;
 		} validatorConfig;
 		std::string func_service;
 		std::string func_validator;
-		std::function<void(std::string& jsonResp, microService&)> serviceFunction;
-		std::function<void(std::string& jsonResp, microService&)> customValidator;
+		std::function<void(std::string& jsonResp, const microService&, requestParameters&)> serviceFunction;
+		std::function<void(std::string& jsonResp, const microService&, requestParameters&)> customValidator;
 		bool audit_enabled {false};
 		std::string audit_record;
+		text_template audit_template;
 		struct email {
 			bool enabled {false}; 
 			std::string body_template; 
@@ -173,8 +255,34 @@ namespace config
 		} email_config;
 	};
 	
+	//allows lookups by std::string_view without creating a temporary std::string
+	struct string_hash 
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+	};
+	using service_map = std::unordered_map<std::string, microService, string_hash, std::equal_to<>>;
+
+	//answer to CORS preflight requests, from the optional "cors" block of config.json
+	struct cors_config
+	{
+		std::string allow_methods {"GET, POST"};
+		std::string allow_headers {"*"}; //"*" echoes Access-Control-Request-Headers, a literal * is not valid with credentials
+		unsigned long max_age {86400}; //seconds the browser may cache the preflight result
+	};
+
+	//optional "listen" block of config.json, a NOTIFY on any of these channels invalidates the cache key in its payload,
+	//or the channel name itself if the payload is empty
+	struct listen_config
+	{
+		std::string db; //database name used by the services, like db1
+		std::vector<std::string> channels;
+	};
+
 	void parse();
-	std::unordered_map<std::string, microService> get_config_map() noexcept;
+	const service_map& get_config_map() noexcept;
+	const cors_config& get_cors() noexcept;
+	const listen_config& get_listen() noexcept;
 }
 
 #endif /* LOGIN_H_ */
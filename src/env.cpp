@@ -7,11 +7,15 @@ namespace
 	struct env_vars 
 	{
 			env_vars();
-			unsigned short int read_env(const char* name, unsigned short int default_value) noexcept;
-			unsigned short int port{read_env("CPP_PORT", 8080)};
-			unsigned short int http_log{read_env("CPP_HTTP_LOG", 0)};
-			unsigned short int login_log{read_env("CPP_LOGIN_LOG", 0)};
-			unsigned short int pool_size{read_env("CPP_POOL_SIZE", 4)};
+			template<typename T> T read_env(const char* name, T default_value) noexcept;
+			unsigned short int port{read_env<unsigned short int>("CPP_PORT", 8080)};
+			unsigned short int http_log{read_env<unsigned short int>("CPP_HTTP_LOG", 0)};
+			unsigned short int login_log{read_env<unsigned short int>("CPP_LOGIN_LOG", 0)};
+			unsigned short int pool_size{read_env<unsigned short int>("CPP_POOL_SIZE", 4)};
+			size_t max_body_size{read_env<size_t>("CPP_MAX_BODY_SIZE", 67108864)};
+			size_t compress_min_size{read_env<size_t>("CPP_COMPRESS_MIN_SIZE", 1024)};
+			size_t file_cache_size{read_env<size_t>("CPP_FILE_CACHE_SIZE", 67108864)};
+			size_t result_cache_size{read_env<size_t>("CPP_RESULT_CACHE_SIZE", 67108864)};
 	};	
 	
 	env_vars ev;
@@ -20,9 +24,9 @@ namespace
 	{
 	}
 
-	unsigned short int env_vars::read_env(const char* name, unsigned short int default_value) noexcept
+	template<typename T> T env_vars::read_env(const char* name, T default_value) noexcept
 	{
-		unsigned short int value{default_value};
+		T value{default_value};
 		if (const char* env_p = std::getenv(name)) {
 			std::string_view str(env_p);
 			auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
@@ -57,4 +61,16 @@ namespace env
 
 	unsigned short int login_log_enabled() noexcept 
 	{ return ev.login_log; }
+
+	size_t max_body_size() noexcept 
+	{ return ev.max_body_size; }
+
+	size_t compress_min_size() noexcept 
+	{ return ev.compress_min_size; }
+
+	size_t file_cache_size() noexcept 
+	{ return ev.file_cache_size; }
+
+	size_t result_cache_size() noexcept 
+	{ return ev.result_cache_size; }
 }
@@ -21,6 +21,10 @@ namespace env
 	unsigned short int http_log_enabled() noexcept;
 	unsigned short int pool_size() noexcept;
 	unsigned short int login_log_enabled() noexcept;
+	size_t max_body_size() noexcept;
+	size_t compress_min_size() noexcept;
+	size_t file_cache_size() noexcept;
+	size_t result_cache_size() noexcept;
 	std::string get_str(std::string name) noexcept;
 }
 
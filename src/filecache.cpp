@@ -0,0 +1,260 @@
+#include "filecache.h"
+
+namespace
+{
+	const std::string LOGGER_SRC {"filecache"};
+
+	struct string_hash {
+		using is_transparent = void;
+		size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+	};
+
+	//keys are paths relative to root_dir, like the request path: "/index.html"
+	std::unordered_map<std::string, filecache::entry_ptr, string_hash, std::equal_to<>> m_entries;
+	std::shared_mutex m_mutex;
+	size_t m_bytes {0};
+	std::atomic<uint64_t> m_generation {0}; //incremented by every invalidation, a load that started before it is not kept
+	std::atomic<uint64_t> m_clock {0}; //last_used ticks for eviction
+	std::atomic<size_t> m_hits {0};
+	std::atomic<size_t> m_misses {0};
+
+	//inotify state, only used by the epoll thread
+	int m_inotify_fd {-1};
+	std::unordered_map<int, std::string> m_watches; //watch descriptor -> directory relative to root_dir
+	constexpr uint32_t watch_mask {IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR};
+
+	void invalidate(std::string_view key) noexcept
+	{
+		std::unique_lock lock {m_mutex};
+		if (auto it = m_entries.find(key); it != m_entries.end()) {
+			m_bytes -= it->second->cost();
+			m_entries.erase(it);
+		}
+		++m_generation;
+	}
+
+	//everything under a directory that was removed, renamed or created
+	void invalidate_prefix(std::string_view prefix) noexcept
+	{
+		std::unique_lock lock {m_mutex};
+		std::erase_if(m_entries, [prefix](const auto& item) {
+			if (!item.first.starts_with(prefix))
+				return false;
+			m_bytes -= item.second->cost();
+			return true;
+		});
+		++m_generation;
+	}
+
+	void add_watch(const std::string& dir) noexcept
+	{
+		const std::string path {filecache::root_dir + dir};
+		const int wd {inotify_add_watch(m_inotify_fd, path.c_str(), watch_mask)};
+		if (wd == -1) {
+			logger::log(LOGGER_SRC, "warn", "inotify_add_watch() failed for " + path + " " + std::string(strerror(errno)));
+			return;
+		}
+		m_watches.insert_or_assign(wd, dir);
+		std::error_code ec;
+		for (auto it = std::filesystem::directory_iterator(path, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec))
+			if (it->is_directory(ec) && !it->is_symlink(ec))
+				add_watch(dir + "/" + it->path().filename().string());
+	}
+
+	//one-shot gzip at the best level, the cost is paid once per file
+	std::string gzip(std::string_view data) noexcept
+	{
+		std::string out;
+		z_stream z {};
+		if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return out;
+		out.resize(deflateBound(&z, data.size()));
+		z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+		z.avail_in = data.size();
+		z.next_out = reinterpret_cast<Bytef*>(out.data());
+		z.avail_out = out.size();
+		const int rc {deflate(&z, Z_FINISH)};
+		out.resize((rc == Z_STREAM_END) ? z.total_out : 0);
+		deflateEnd(&z);
+		return out;
+	}
+
+	void set_headers(filecache::entry& e) noexcept
+	{
+		const std::string common {"Content-Type: " + std::string(e.content_type) + "\r\n" 
+			+ "ETag: " + e.etag + "\r\n" 
+			+ "Last-Modified: " + e.last_modified + "\r\n"
+			+ "Accept-Ranges: bytes\r\n"};
+		e.headers = "Content-Length: " + std::to_string(e.body.size()) + "\r\n" + common;
+		if (!e.gzip.empty()) {
+			e.headers.append("Vary: Accept-Encoding\r\n");
+			e.gzip_headers = "Content-Length: " + std::to_string(e.gzip.size()) + "\r\n" + common
+				+ "Vary: Accept-Encoding\r\n" + "Content-Encoding: gzip\r\n";
+		}
+	}
+
+	//drop the least recently used entries until needed bytes fit in the budget, caller holds the unique lock
+	void evict(size_t needed, size_t budget) noexcept
+	{
+		std::vector<std::pair<uint64_t, std::string_view>> lru;
+		lru.reserve(m_entries.size());
+		for (const auto& [key, e]: m_entries)
+			lru.emplace_back(e->last_used.load(std::memory_order_relaxed), key);
+		std::sort(lru.begin(), lru.end());
+		std::vector<std::string> victims;
+		size_t bytes {m_bytes};
+		for (const auto& [tick, key]: lru) {
+			if (bytes + needed <= budget)
+				break;
+			bytes -= m_entries.find(key)->second->cost();
+			victims.emplace_back(key);
+		}
+		for (const auto& key: victims)
+			m_entries.erase(key);
+		m_bytes = bytes;
+	}
+
+	void insert(std::string_view key, const filecache::entry_ptr& e, uint64_t generation) noexcept
+	{
+		const size_t budget {env::file_cache_size()};
+		const size_t cost {e->cost()};
+		if (cost > budget)
+			return;
+		std::unique_lock lock {m_mutex};
+		if (generation != m_generation)
+			return;
+		if (auto it = m_entries.find(key); it != m_entries.end()) {
+			m_bytes -= it->second->cost();
+			m_entries.erase(it);
+		}
+		if (m_bytes + cost > budget)
+			evict(cost, budget);
+		e->last_used.store(++m_clock, std::memory_order_relaxed);
+		m_entries.emplace(key, e);
+		m_bytes += cost;
+	}
+}
+
+namespace filecache
+{
+	size_t entry::cost() const noexcept
+	{
+		return sizeof(entry) + body.size() + gzip.size() + etag.size() + last_modified.size() + headers.size() + gzip_headers.size();
+	}
+
+	int start() noexcept
+	{
+		if (env::file_cache_size() == 0) {
+			logger::log(LOGGER_SRC, "info", "static file cache disabled");
+			return -1;
+		}
+		m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (m_inotify_fd == -1) {
+			logger::log(LOGGER_SRC, "error", "inotify_init1() failed, static file cache disabled " + std::string(strerror(errno)));
+			return -1;
+		}
+		add_watch("");
+		if (m_watches.empty()) {
+			close(m_inotify_fd);
+			m_inotify_fd = -1;
+			logger::log(LOGGER_SRC, "warn", root_dir + " cannot be watched, static file cache disabled");
+			return -1;
+		}
+		logger::log(LOGGER_SRC, "info", "watching " + std::to_string(m_watches.size()) + " directories under " + root_dir);
+		return m_inotify_fd;
+	}
+
+	void on_notify() noexcept
+	{
+		alignas(inotify_event) std::array<char, 8192> buffer;
+		while (true) {
+			const ssize_t len {read(m_inotify_fd, buffer.data(), buffer.size())};
+			if (len <= 0)
+				break;
+			for (const char* p = buffer.data(); p < buffer.data() + len; ) {
+				const auto* ev {reinterpret_cast<const inotify_event*>(p)};
+				p += sizeof(inotify_event) + ev->len;
+				if (ev->mask & IN_Q_OVERFLOW) {
+					logger::log(LOGGER_SRC, "warn", "inotify queue overflow, static file cache cleared");
+					invalidate_prefix("");
+					continue;
+				}
+				auto w = m_watches.find(ev->wd);
+				if (w == m_watches.end())
+					continue;
+				if (ev->mask & IN_IGNORED) {
+					m_watches.erase(w);
+					continue;
+				}
+				if (ev->len == 0)
+					continue;
+				const std::string path {w->second + "/" + ev->name};
+				if (ev->mask & IN_ISDIR) {
+					if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+						add_watch(path);
+					invalidate_prefix(path + "/");
+				} else
+					invalidate(path);
+			}
+		}
+	}
+
+	entry_ptr find(std::string_view path) noexcept
+	{
+		if (m_inotify_fd == -1)
+			return nullptr;
+		thread_local std::string index;
+		if (path.ends_with('/')) {
+			index.assign(path).append("index.html");
+			path = index;
+		}
+		std::shared_lock lock {m_mutex};
+		if (auto it = m_entries.find(path); it != m_entries.end()) {
+			it->second->last_used.store(++m_clock, std::memory_order_relaxed);
+			++m_hits;
+			return it->second;
+		}
+		++m_misses;
+		return nullptr;
+	}
+
+	entry_ptr load(const std::string& target, int fd, const struct stat& st) noexcept
+	{
+		if (m_inotify_fd == -1 || static_cast<size_t>(st.st_size) > max_file_size || !S_ISREG(st.st_mode)
+			|| !target.starts_with(root_dir) || target.find("/..") != std::string::npos)
+			return nullptr;
+		const uint64_t generation {m_generation};
+		auto e {std::make_shared<entry>()};
+		e->body.resize(st.st_size);
+		size_t total {0};
+		while (total < e->body.size()) {
+			const ssize_t count {pread(fd, e->body.data() + total, e->body.size() - total, total)};
+			if (count == -1 && errno == EINTR)
+				continue;
+			if (count <= 0)
+				break;
+			total += count;
+		}
+		if (total != e->body.size())
+			return nullptr;
+
+		e->content_type = http::get_content_type(target);
+		e->etag = http::get_etag(e->body);
+		e->mtime = st.st_mtime;
+		e->last_modified = http::format_http_date(st.st_mtime);
+		if (e->body.size() >= env::compress_min_size() && http::is_compressible(e->content_type)) {
+			e->gzip = gzip(e->body);
+			if (e->gzip.size() >= e->body.size())
+				e->gzip.clear();
+		}
+		set_headers(*e);
+		insert(std::string_view(target).substr(root_dir.size()), e, generation);
+		return e;
+	}
+
+	stats get_stats() noexcept
+	{
+		std::shared_lock lock {m_mutex};
+		return {m_hits, m_misses, m_bytes, m_entries.size()};
+	}
+}
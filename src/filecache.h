@@ -0,0 +1,69 @@
+/*
+ * filecache - in-memory cache of the static files under /var/www, invalidated by inotify
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Martin Cordova cppserver@martincordova.com - https://cppserver.com
+ *      Disclaimer: some parts of this library may have been taken from sample code publicly available
+ *		and written by third parties. Free to use in commercial projects, no warranties and no responsabilities assumed
+ *		by the author, use at your own risk. By using this code you accept the forementioned conditions.
+ */
+#ifndef FILECACHE_H_
+#define FILECACHE_H_
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <filesystem>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctime>
+#include <zlib.h>
+#include "env.h"
+#include "logger.h"
+#include "httputils.h"
+
+namespace filecache
+{
+	const std::string root_dir {"/var/www"};
+	constexpr size_t max_file_size {4194304}; //larger files are read from disk on every request
+
+	//file contents plus the headers that only depend on the file, built once when it is loaded
+	struct entry {
+		std::string body;
+		std::string gzip; //empty if the file is not compressible or gzip does not make it smaller
+		std::string etag;
+		std::string last_modified;
+		std::string_view content_type;
+		std::time_t mtime {0};
+		std::string headers; //Content-Length, Content-Type, ETag, Last-Modified, Accept-Ranges and Vary
+		std::string gzip_headers; //same for the gzip variant, plus Content-Encoding
+		mutable std::atomic<uint64_t> last_used {0};
+		size_t cost() const noexcept;
+	};
+	using entry_ptr = std::shared_ptr<const entry>;
+
+	struct stats {
+		size_t hits;
+		size_t misses;
+		size_t bytes;
+		size_t entries;
+	};
+
+	//adds inotify watches for root_dir and its subdirectories, returns the inotify fd for the epoll loop or -1 if disabled
+	int start() noexcept;
+	//reads the pending inotify events and drops the affected entries, called by the epoll loop
+	void on_notify() noexcept;
+	//path is the request path, a trailing '/' means index.html
+	entry_ptr find(std::string_view path) noexcept;
+	//reads the open file target if it can be cached, nullptr if it is too large, unreadable or the cache is disabled
+	entry_ptr load(const std::string& target, int fd, const struct stat& st) noexcept;
+	stats get_stats() noexcept;
+}
+
+#endif /* FILECACHE_H_ */
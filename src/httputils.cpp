@@ -20,37 +20,55 @@ namespace http
 		return res;
 	}
 
-	void save_blob(const std::string& filename, const std::string& content) noexcept 
+	//value for the Date header, each thread formats it at most once per second
+	std::string_view get_response_date() noexcept
 	{
-		std::string blob {blob_path + filename};
-		std::ofstream ofs(blob, std::ios::binary);
-		if ( ofs.is_open() )
-			ofs << content;
-		else 
-			logger::log("http", "error",  std::string(__PRETTY_FUNCTION__) +  " cannot write to file: " + blob, true);
+		thread_local std::array<char, 32> buffer {};
+		thread_local std::time_t last {0};
+		thread_local size_t len {0};
+		if (const std::time_t now {std::time(nullptr)}; now != last) {
+			std::tm tm;
+			gmtime_r(&now, &tm);
+			len = std::strftime(buffer.data(), buffer.size(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+			last = now;
+		}
+		return std::string_view(buffer.data(), len);
+	}
+
+	std::string format_http_date(std::time_t t) noexcept
+	{
+		std::array<char, 32> buffer;
+		std::tm tm;
+		gmtime_r(&t, &tm);
+		const size_t len {std::strftime(buffer.data(), buffer.size(), "%a, %d %b %Y %H:%M:%S GMT", &tm)};
+		return std::string(buffer.data(), len);
 	}
 
-	std::string get_response_date() noexcept
+	std::time_t parse_http_date(std::string_view date) noexcept
 	{
-		auto t = std::time(nullptr);
-		auto tm = *std::localtime(&t);
-		std::ostringstream oss;
-		oss << std::put_time(&tm, "%a, %d %b %Y %H:%M:%S GMT");
-		return oss.str();
+		std::array<char, 32> buffer;
+		if (date.size() >= buffer.size())
+			return -1;
+		std::memcpy(buffer.data(), date.data(), date.size());
+		buffer[date.size()] = '\0';
+		std::tm tm {};
+		const char* end {strptime(buffer.data(), "%a, %d %b %Y %H:%M:%S GMT", &tm)};
+		if (end == nullptr || *end != '\0')
+			return -1;
+		return timegm(&tm);
 	}
 
-	std::string get_file_extension(const std::string& filename) noexcept
+	std::string_view get_file_extension(std::string_view filename) noexcept
 	{
-		if (auto pos = filename.find_last_of("."); pos != std::string::npos)
+		if (auto pos = filename.find_last_of('.'); pos != std::string_view::npos)
 			return filename.substr(pos + 1);
 		else
 			return "";
 	}
 
-	std::string get_content_type(const std::string& filename) noexcept
+	std::string_view get_content_type(std::string_view filename) noexcept
 	{
-
-		std::unordered_map<std::string, std::string> mime_types 
+		static const std::unordered_map<std::string_view, std::string_view> mime_types 
 		{
 			{"pdf", "application/pdf"},
 			{"css", "text/css"},
@@ -81,21 +99,105 @@ namespace http
 		if (auto mime = mime_types.find( get_file_extension(filename) ); mime != mime_types.end() )
 		  return mime->second;
 		else {
-			logger::log("http", "warn", std::string(__PRETTY_FUNCTION__) + " content-type not defined for file: " + filename, true);
+			logger::log("http", "warn", std::string(__PRETTY_FUNCTION__) + " content-type not defined for file: " + std::string(filename), true);
 			return "application/octet-stream";
 		}
 	}
 
+	constexpr std::array<std::string_view, static_cast<size_t>(header::count)> header_names 
+	{
+		"host",
+		"user-agent",
+		"accept",
+		"accept-encoding",
+		"accept-language",
+		"connection",
+		"content-length",
+		"content-type",
+		"cookie",
+		"origin",
+		"referer",
+		"expect",
+		"if-none-match",
+		"if-modified-since",
+		"if-range",
+		"range",
+		"access-control-request-method",
+		"access-control-request-headers",
+		"x-forwarded-for",
+		"x-request-id"
+	};
+
+	constexpr char to_lower(char c) noexcept
+	{
+		return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+	}
+
+	//ASCII case-insensitive comparison for header names
+	inline bool iequals(std::string_view a, std::string_view b) noexcept
+	{
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); i++)
+			if (to_lower(a[i]) != to_lower(b[i]))
+				return false;
+		return true;
+	}
+
+	inline std::string_view trim(std::string_view value) noexcept
+	{
+		while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+			value.remove_prefix(1);
+		while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+			value.remove_suffix(1);
+		return value;
+	}
+
+	//cheap case-insensitive signature (length, first, middle and last char), names are compared only when it matches
+	constexpr uint32_t header_hash(std::string_view name) noexcept
+	{
+		if (name.empty())
+			return 0;
+		const auto len {name.size()};
+		return (static_cast<uint32_t>(len & 0xff) << 24)
+			| (static_cast<uint32_t>(static_cast<unsigned char>(to_lower(name[0]))) << 16)
+			| (static_cast<uint32_t>(static_cast<unsigned char>(to_lower(name[len / 2]))) << 8)
+			| static_cast<uint32_t>(static_cast<unsigned char>(to_lower(name[len - 1])));
+	}
+
+	constexpr std::array<uint32_t, static_cast<size_t>(header::count)> header_hashes 
+	{
+		[]() {
+			std::array<uint32_t, static_cast<size_t>(header::count)> h{};
+			for (size_t i = 0; i < h.size(); i++)
+				h[i] = header_hash(header_names[i]);
+			return h;
+		}()
+	};
+
+	//returns header::count if the name is not a known header
+	inline header get_header_id(std::string_view name, uint32_t hash) noexcept
+	{
+		for (size_t i = 0; i < header_hashes.size(); i++)
+			if (header_hashes[i] == hash && iequals(name, header_names[i]))
+				return static_cast<header>(i);
+		return header::count;
+	}
+
 	struct line_reader {
 	  public:
 		bool eof{false};
 		
 		line_reader(std::string_view str) : buffer{str} { }
 		
+		size_t position() const noexcept {
+			return pos;
+		}
+
 		std::string_view getline() {
-			if (auto newpos = buffer.find(line_sep, pos); newpos != std::string::npos && newpos!= 0) {
+			if (auto newpos = scan::find_crlf(buffer, pos); newpos != std::string::npos && newpos!= 0) {
 				std::string_view line { buffer.substr( pos, newpos - pos ) };
-				pos = newpos + line_sep.size();
+				pos = newpos + 2;
 				return line;
 			} else {
 				eof = true;
@@ -105,10 +207,464 @@ namespace http
 		
 	  private:
 		std::string_view buffer;
-		int pos{0};
-		const std::string line_sep{"\r\n"};
+		size_t pos{0};
+	};
+
+
+	//single-pass reader for JSON request bodies, string values are unescaped, other values are kept as JSON text
+	struct json_reader {
+	  public:
+		json_reader(std::string_view str) : json{str} { }
+
+		bool eof() noexcept {
+			skip_ws();
+			return pos >= json.size();
+		}
+
+		bool next(char c) noexcept {
+			skip_ws();
+			if (pos < json.size() && json[pos] == c) {
+				pos++;
+				return true;
+			}
+			return false;
+		}
+
+		bool read_string(std::string& out) noexcept {
+			if (!next('"'))
+				return false;
+			while (true) {
+				const size_t p {scan::find_first_of(json, '"', '\\', pos)};
+				if (p == std::string::npos)
+					return false;
+				out.append(json.data() + pos, p - pos);
+				pos = p + 1;
+				if (json[p] == '"')
+					return true;
+				if (pos >= json.size())
+					return false;
+				switch (const char c {json[pos++]}; c) {
+					case '"': case '\\': case '/': out.push_back(c); break;
+					case 'b': out.push_back('\b'); break;
+					case 'f': out.push_back('\f'); break;
+					case 'n': out.push_back('\n'); break;
+					case 'r': out.push_back('\r'); break;
+					case 't': out.push_back('\t'); break;
+					case 'u': if (!read_unicode(out)) return false; break;
+					default: return false;
+				}
+			}
+		}
+
+		//scalar values are returned as they appear in the JSON text, null as an empty string
+		bool read_value(std::string& out) noexcept {
+			skip_ws();
+			if (pos >= json.size())
+				return false;
+			if (json[pos] == '"')
+				return read_string(out);
+			const size_t start {pos};
+			if (json[pos] == '{' || json[pos] == '[') {
+				if (!skip_nested())
+					return false;
+			} else {
+				while (pos < json.size() && json[pos] != ',' && json[pos] != '}' && json[pos] != ']' 
+					&& json[pos] != ' ' && json[pos] != '\t' && json[pos] != '\r' && json[pos] != '\n')
+					pos++;
+				if (pos == start)
+					return false;
+				if (const std::string_view token {json.substr(start, pos - start)}; token == "null")
+					return true;
+				else if (token != "true" && token != "false" && !is_number(token))
+					return false;
+			}
+			out.append(json.substr(start, pos - start));
+			return true;
+		}
+
+	  private:
+		std::string_view json;
+		size_t pos{0};
+
+		void skip_ws() noexcept {
+			while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\r' || json[pos] == '\n'))
+				pos++;
+		}
+
+		static bool is_number(std::string_view token) noexcept {
+			double value;
+			auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+			return ec == std::errc() && ptr == token.data() + token.size();
+		}
+
+		bool read_hex4(unsigned& cp) noexcept {
+			if (pos + 4 > json.size())
+				return false;
+			auto [ptr, ec] = std::from_chars(json.data() + pos, json.data() + pos + 4, cp, 16);
+			if (ec != std::errc() || ptr != json.data() + pos + 4)
+				return false;
+			pos += 4;
+			return true;
+		}
+
+		//\uXXXX escape (with surrogate pairs) to UTF-8
+		bool read_unicode(std::string& out) noexcept {
+			unsigned cp {0};
+			if (!read_hex4(cp))
+				return false;
+			if (cp >= 0xD800 && cp <= 0xDBFF) {
+				unsigned low {0};
+				if (json.substr(pos, 2) != "\\u")
+					return false;
+				pos += 2;
+				if (!read_hex4(low) || low < 0xDC00 || low > 0xDFFF)
+					return false;
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+			}
+			if (cp < 0x80) {
+				out.push_back(static_cast<char>(cp));
+			} else if (cp < 0x800) {
+				out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+				out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+			} else if (cp < 0x10000) {
+				out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+				out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+				out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+			} else {
+				out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+				out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+				out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+				out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+			}
+			return true;
+		}
+
+		//moves past a nested object or array, only brackets outside of strings are counted
+		bool skip_nested() noexcept {
+			int depth {0};
+			while (pos < json.size()) {
+				switch (json[pos]) {
+					case '{': case '[':
+						depth++;
+						break;
+					case '}': case ']':
+						if (--depth == 0) {
+							pos++;
+							return true;
+						}
+						break;
+					case '"':
+						for (pos++; pos < json.size() && json[pos] != '"'; pos++)
+							if (json[pos] == '\\')
+								pos++;
+						if (pos >= json.size())
+							return false;
+						break;
+				}
+				pos++;
+			}
+			return false;
+		}
+	};
+
+	bool parse_json_object(std::string_view json, std::unordered_map<std::string, std::string>& params) noexcept
+	{
+		json_reader reader(json);
+		if (!reader.next('{'))
+			return false;
+		if (reader.next('}'))
+			return reader.eof();
+		do {
+			std::string name;
+			std::string value;
+			if (!reader.read_string(name) || !reader.next(':') || !reader.read_value(value))
+				return false;
+			if (!name.empty())
+				params.emplace(std::move(name), std::move(value));
+		} while (reader.next(','));
+		return reader.next('}') && reader.eof();
+	}
+
+	bool parse_json_array(std::string_view json, std::vector<std::string>& items) noexcept
+	{
+		json_reader reader(json);
+		if (!reader.next('['))
+			return false;
+		if (reader.next(']'))
+			return reader.eof();
+		do {
+			std::string value;
+			if (!reader.read_value(value))
+				return false;
+			items.push_back(std::move(value));
+		} while (reader.next(','));
+		return reader.next(']') && reader.eof();
+	}
+
+	int find_accepted(std::string_view header, std::string_view value) noexcept
+	{
+		size_t pos {0};
+		while (pos < header.size()) {
+			const size_t end {std::min(scan::find_char(header, ',', pos), header.size())};
+			const std::string_view item {header.substr(pos, end - pos)};
+			pos = end + 1;
+			const size_t semi {scan::find_char(item, ';')};
+			if (!iequals(trim(item.substr(0, semi)), value))
+				continue;
+			//a media range may have other parameters before q
+			std::string_view params {(semi == std::string::npos) ? std::string_view{} : item.substr(semi + 1)};
+			while (!params.empty()) {
+				const size_t next {std::min(scan::find_char(params, ';'), params.size())};
+				const std::string_view param {trim(params.substr(0, next))};
+				params = (next == params.size()) ? std::string_view{} : params.substr(next + 1);
+				if (param.starts_with("q=") || param.starts_with("Q="))
+					return (param.find_first_not_of("0.", 2) == std::string::npos) ? 0 : 1;
+			}
+			return 1;
+		}
+		return -1;
+	}
+
+	//picks gzip or deflate from the Accept-Encoding header, a coding listed with q=0 is refused even if * is accepted
+	content_encoding get_content_encoding(std::string_view accept_encoding) noexcept
+	{
+		int gzip {find_accepted(accept_encoding, "gzip")};
+		if (gzip == -1)
+			gzip = find_accepted(accept_encoding, "x-gzip");
+		if (gzip == 1)
+			return content_encoding::gzip;
+		const int deflate {find_accepted(accept_encoding, "deflate")};
+		if (deflate == 1)
+			return content_encoding::deflate;
+		if (find_accepted(accept_encoding, "*") == 1) {
+			if (gzip == -1)
+				return content_encoding::gzip;
+			if (deflate == -1)
+				return content_encoding::deflate;
+		}
+		return content_encoding::identity;
+	}
+
+	std::string_view get_encoding_name(content_encoding enc) noexcept
+	{
+		switch (enc) {
+			case content_encoding::gzip: return "gzip";
+			case content_encoding::deflate: return "deflate";
+			default: return "identity";
+		}
+	}
+
+	bool is_compressible(std::string_view content_type) noexcept
+	{
+		return content_type.starts_with("text/") || content_type.contains("json") 
+			|| content_type.contains("javascript") || content_type.contains("xml");
+	}
+
+	//xxHash64, processes 32 bytes per round in four independent lanes
+	namespace
+	{
+		constexpr uint64_t prime1 {0x9E3779B185EBCA87ULL};
+		constexpr uint64_t prime2 {0xC2B2AE3D27D4EB4FULL};
+		constexpr uint64_t prime3 {0x165667B19E3779F9ULL};
+		constexpr uint64_t prime4 {0x85EBCA77C2B2AE63ULL};
+		constexpr uint64_t prime5 {0x27D4EB2F165667C5ULL};
+
+		inline uint64_t rotl(uint64_t x, int r) noexcept
+		{
+			return (x << r) | (x >> (64 - r));
+		}
+
+		inline uint64_t read64(const char* p) noexcept
+		{
+			uint64_t v;
+			std::memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		inline uint32_t read32(const char* p) noexcept
+		{
+			uint32_t v;
+			std::memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		inline uint64_t round(uint64_t acc, uint64_t input) noexcept
+		{
+			return rotl(acc + input * prime2, 31) * prime1;
+		}
+
+		inline uint64_t merge(uint64_t acc, uint64_t val) noexcept
+		{
+			return (acc ^ round(0, val)) * prime1 + prime4;
+		}
+	}
+
+	uint64_t hash64(std::string_view data, uint64_t seed) noexcept
+	{
+		const char* p {data.data()};
+		const char* const end {p + data.size()};
+		uint64_t h;
+		if (data.size() >= 32) {
+			uint64_t v1 {seed + prime1 + prime2}, v2 {seed + prime2}, v3 {seed}, v4 {seed - prime1};
+			for (; p + 32 <= end; p += 32) {
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+			}
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = merge(h, v1);
+			h = merge(h, v2);
+			h = merge(h, v3);
+			h = merge(h, v4);
+		} else
+			h = seed + prime5;
+		h += data.size();
+		for (; p + 8 <= end; p += 8)
+			h = rotl(h ^ round(0, read64(p)), 27) * prime1 + prime4;
+		if (p + 4 <= end) {
+			h = rotl(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+			p += 4;
+		}
+		for (; p < end; p++)
+			h = rotl(h ^ (static_cast<unsigned char>(*p) * prime5), 11) * prime1;
+		h ^= h >> 33;
+		h *= prime2;
+		h ^= h >> 29;
+		h *= prime3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	std::string get_etag(std::string_view data) noexcept
+	{
+		std::array<char, 16> hex;
+		const uint64_t h {hash64(data)};
+		constexpr std::string_view digits {"0123456789abcdef"};
+		for (int i = 0; i < 16; i++)
+			hex[i] = digits[(h >> (60 - 4 * i)) & 0xF];
+		std::string etag {"W/\""};
+		etag.append(hex.data(), hex.size()).push_back('"');
+		return etag;
+	}
+
+	bool etag_matches(std::string_view if_none_match, std::string_view etag) noexcept
+	{
+		if (etag.starts_with("W/"))
+			etag.remove_prefix(2);
+		size_t pos {0};
+		while (pos < if_none_match.size()) {
+			const size_t end {std::min(scan::find_char(if_none_match, ',', pos), if_none_match.size())};
+			std::string_view tag {trim(if_none_match.substr(pos, end - pos))};
+			pos = end + 1;
+			if (tag == "*")
+				return true;
+			if (tag.starts_with("W/"))
+				tag.remove_prefix(2);
+			if (tag == etag)
+				return true;
+		}
+		return false;
+	}
+
+	bool parse_range(std::string_view header, size_t size, std::vector<byte_range>& ranges) noexcept
+	{
+		ranges.clear();
+		constexpr std::string_view unit {"bytes="};
+		if (header.size() < unit.size() || !iequals(header.substr(0, unit.size()), unit))
+			return false;
+		header.remove_prefix(unit.size());
+		auto number = [](std::string_view s, size_t& value) {
+			auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+			return !s.empty() && ec == std::errc() && ptr == s.data() + s.size();
+		};
+		size_t pos {0};
+		size_t count {0};
+		while (pos <= header.size()) {
+			const size_t end {std::min(scan::find_char(header, ',', pos), header.size())};
+			const std::string_view spec {trim(header.substr(pos, end - pos))};
+			pos = end + 1;
+			if (spec.empty())
+				continue;
+			if (++count > max_ranges)
+				return false;
+			const size_t dash {spec.find('-')};
+			if (dash == std::string_view::npos)
+				return false;
+			const std::string_view first {spec.substr(0, dash)};
+			const std::string_view last {spec.substr(dash + 1)};
+			size_t a {0};
+			size_t b {0};
+			if (first.empty()) {
+				//suffix range, the last b bytes
+				if (!number(last, b))
+					return false;
+				if (b == 0 || size == 0)
+					continue;
+				b = std::min(b, size);
+				ranges.push_back({size - b, b});
+				continue;
+			}
+			if (!number(first, a))
+				return false;
+			if (last.empty())
+				b = size - 1;
+			else if (!number(last, b) || b < a)
+				return false;
+			if (a >= size)
+				continue;
+			b = std::min(b, size - 1);
+			ranges.push_back({a, b - a + 1});
+		}
+		return count > 0;
+	}
+
+	//one deflate state per encoding and thread, reset instead of allocated for every response
+	struct zstream {
+		z_stream z {};
+		bool ready {false};
+		
+		zstream(int window_bits) {
+			ready = deflateInit2(&z, compression_level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+			if (!ready)
+				logger::log("http", "error", std::string(__PRETTY_FUNCTION__) + " deflateInit2() failed", true);
+		}
+		
+		~zstream() {
+			if (ready)
+				deflateEnd(&z);
+		}
 	};
 
+	bool compress(content_encoding enc, std::string_view data, std::string& out, bool start, bool finish) noexcept
+	{
+		thread_local zstream gzip_stream {15 + 16};
+		thread_local zstream deflate_stream {15};
+		zstream& zs {(enc == content_encoding::gzip) ? gzip_stream : deflate_stream};
+		if (!zs.ready || enc == content_encoding::identity)
+			return false;
+		z_stream& z {zs.z};
+		if (start)
+			deflateReset(&z);
+		z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+		z.avail_in = data.size();
+		const int flush {finish ? Z_FINISH : Z_SYNC_FLUSH};
+		while (true) {
+			const size_t offset {out.size()};
+			const size_t room {deflateBound(&z, z.avail_in) + 16};
+			out.resize(offset + room);
+			z.next_out = reinterpret_cast<Bytef*>(out.data() + offset);
+			z.avail_out = room;
+			const int rc {deflate(&z, flush)};
+			out.resize(offset + room - z.avail_out);
+			if (rc == Z_STREAM_END || (rc == Z_OK && z.avail_out != 0) || rc == Z_BUF_ERROR)
+				return true;
+			if (rc != Z_OK) {
+				logger::log("http", "error", std::string(__PRETTY_FUNCTION__) + " deflate() failed: " + std::to_string(rc), true);
+				return false;
+			}
+		}
+	}
 
 	response_stream::response_stream(int size) {
 		_buffer.reserve(size);
@@ -118,7 +674,12 @@ namespace http
 		_buffer.reserve(16383);
 	}
 	
-	response_stream& response_stream::operator <<(std::string data) {
+	response_stream& response_stream::operator <<(const std::string& data) {
+		_buffer.append(data);
+		return *this;
+	}
+
+	response_stream& response_stream::operator <<(std::string_view data) {
 		_buffer.append(data);
 		return *this;
 	}
@@ -129,7 +690,9 @@ namespace http
 	}
 
 	response_stream& response_stream::operator <<(size_t data) {
-		_buffer.append(std::to_string(data));
+		std::array<char, 24> str;
+		auto [ptr, ec] = std::to_chars(str.data(), str.data() + str.size(), data);
+		_buffer.append(str.data(), ptr - str.data());
 		return *this;
 	}
 
@@ -156,41 +719,231 @@ namespace http
 	
 	void response_stream::clear() noexcept {
 		_buffer.clear();
+		_segments.clear();
+		_segment = 0;
+		_segment_pos = 0;
+		_owner.reset();
+		_file.reset();
 		_pos1 = 0;
+		_fd = -1;
+		_chunked = false;
+		_failed = false;
+		_close = false;
 	}
 
-	bool response_stream::write (int fd) noexcept 
+	//body is sent at this point of the response straight from owner's memory, owner is released by clear()
+	void response_stream::attach(std::shared_ptr<const void> owner, std::string_view body) noexcept
 	{
-		const char* buf = data();
-		buf += _pos1;
-		const char* end = data() + size();
-		ssize_t count = send(fd, buf, end - buf, MSG_NOSIGNAL);
-		#ifdef DEBUG
-			logger::log("epoll", "DEBUG", "send " + std::to_string(count) + " bytes FD: " + std::to_string(fd));
-		#endif			
-		if (count > 0) {
-			buf += count;
-			_pos1 += count;
+		_owner = std::move(owner);
+		add_segment(body.data(), 0, body.size());
+	}
+
+	//the response owns fd from now on, it is closed by clear()
+	void response_stream::set_file(int fd) noexcept
+	{
+		_file.reset();
+		_file.fd = fd;
+	}
+
+	//bytes of the file set by set_file(), sent at this point of the response with sendfile
+	void response_stream::attach_file(off_t offset, size_t length) noexcept
+	{
+		add_segment(nullptr, offset, length);
+	}
+
+	void response_stream::add_segment(const char* data, off_t offset, size_t length) noexcept
+	{
+		if (length > 0)
+			_segments.push_back({_buffer.size(), data, offset, length});
+	}
+
+	//move the send position count bytes forward across buffer text and segments
+	void response_stream::advance(size_t count) noexcept
+	{
+		while (count > 0) {
+			const size_t stop {(_segment < _segments.size()) ? _segments[_segment].at : _buffer.size()};
+			if (_pos1 < stop) {
+				const size_t n {std::min(count, stop - _pos1)};
+				_pos1 += n;
+				count -= n;
+				continue;
+			}
+			if (_segment == _segments.size())
+				return;
+			const size_t n {std::min(count, _segments[_segment].length - _segment_pos)};
+			_segment_pos += n;
+			count -= n;
+			if (_segment_pos == _segments[_segment].length) {
+				++_segment;
+				_segment_pos = 0;
+			}
 		}
-		while (buf != end)
-		{
-			count = send(fd, buf, end - buf, MSG_NOSIGNAL);
+	}
+
+	response_stream::file_ref::file_ref(file_ref&& other) noexcept: fd {std::exchange(other.fd, -1)}
+	{
+	}
+
+	response_stream::file_ref& response_stream::file_ref::operator=(file_ref&& other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			fd = std::exchange(other.fd, -1);
+		}
+		return *this;
+	}
+
+	response_stream::file_ref::~file_ref()
+	{
+		reset();
+	}
+
+	void response_stream::file_ref::reset() noexcept
+	{
+		if (fd != -1) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	//switch to chunked transfer-encoding, the headers already in the buffer will be sent with the first chunk
+	void response_stream::begin_chunked(int fd) noexcept
+	{
+		_fd = fd;
+		_chunked = true;
+	}
+
+	bool response_stream::is_chunked() const noexcept
+	{
+		return _chunked;
+	}
+
+	//append a chunk, it gets sent to the client when the buffer reaches chunk_size
+	bool response_stream::write_chunk(std::string_view data) noexcept
+	{
+		if (_failed)
+			return false;
+		if (data.empty())
+			return true;
+		std::array<char, 16> hex{0};
+		auto [ptr, ec] = std::to_chars(hex.data(), hex.data() + hex.size(), data.size(), 16);
+		_buffer.append(hex.data(), ptr - hex.data()).append("\r\n").append(data).append("\r\n");
+		if (_buffer.size() >= chunk_size)
+			return flush();
+		return true;
+	}
+
+	//append the last-chunk, the epoll loop will send whatever remains in the buffer
+	bool response_stream::end_chunked() noexcept
+	{
+		if (_failed)
+			return false;
+		_buffer.append("0\r\n\r\n");
+		return true;
+	}
+
+	//send the buffer from the calling thread, blocks while the socket buffer is full (backpressure)
+	bool response_stream::flush() noexcept
+	{
+		if (_failed)
+			return false;
+		const char* buf = _buffer.data() + _pos1;
+		size_t pending = _buffer.size() - _pos1;
+		while (pending) {
+			ssize_t count = send(_fd, buf, pending, MSG_NOSIGNAL);
 			if (count > 0) {
 				buf += count;
-				_pos1 += count;
+				pending -= count;
 				continue;
-			} else { 
-				if (errno == EAGAIN)
-					return false;
 			}
-			if (count <= 0 && errno != EAGAIN) {
-				logger::log("epoll", "error", std::string(__FUNCTION__) + " send() error: " + std::string(strerror(errno)) + " FD: " + std::to_string(fd));
-				return true;
+			if (count == -1 && errno == EINTR)
+				continue;
+			if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				pollfd pfd {_fd, POLLOUT, 0};
+				if (poll(&pfd, 1, send_timeout) == 1 && !(pfd.revents & (POLLERR | POLLHUP)))
+					continue;
+				logger::log("epoll", "error", std::string(__FUNCTION__) + " timeout waiting for client to read chunked response FD: " + std::to_string(_fd), true);
+			} else {
+				logger::log("epoll", "error", std::string(__FUNCTION__) + " send() error: " + std::string(strerror(errno)) + " FD: " + std::to_string(_fd), true);
 			}
+			_failed = true;
+			_close = true;
+			_buffer.clear();
+			_pos1 = 0;
+			return false;
 		}
+		_buffer.clear();
+		_pos1 = 0;
 		return true;
 	}
 
+	//the connection will be closed once the response has been sent
+	void response_stream::close_connection() noexcept
+	{
+		_close = true;
+	}
+
+	bool response_stream::must_close() const noexcept
+	{
+		return _close;
+	}
+
+	//buffer text and memory segments go out with one sendmsg, file segments with sendfile
+	bool response_stream::write (int fd) noexcept 
+	{
+		constexpr size_t max_iov {16};
+		while (true)
+		{
+			std::array<iovec, max_iov> iov;
+			size_t n {0};
+			size_t pos {_pos1};
+			size_t seg {_segment};
+			size_t seg_pos {_segment_pos};
+			while (n < max_iov) {
+				const size_t stop {(seg < _segments.size()) ? _segments[seg].at : _buffer.size()};
+				if (pos < stop) {
+					iov[n++] = {_buffer.data() + pos, stop - pos};
+					pos = stop;
+				} else if (seg < _segments.size() && _segments[seg].data != nullptr) {
+					iov[n++] = {const_cast<char*>(_segments[seg].data) + seg_pos, _segments[seg].length - seg_pos};
+					++seg;
+					seg_pos = 0;
+				} else
+					break;
+			}
+			ssize_t count {0};
+			if (n > 0) {
+				msghdr msg {};
+				msg.msg_iov = iov.data();
+				msg.msg_iovlen = n;
+				count = sendmsg(fd, &msg, (seg < _segments.size()) ? MSG_NOSIGNAL | MSG_MORE : MSG_NOSIGNAL);
+			} else if (_segment < _segments.size()) {
+				const segment& s {_segments[_segment]};
+				off_t offset {s.offset + static_cast<off_t>(_segment_pos)};
+				count = sendfile(fd, _file.fd, &offset, s.length - _segment_pos);
+				if (count == 0) {
+					logger::log("epoll", "error", std::string(__FUNCTION__) + " file is shorter than expected, closing FD: " + std::to_string(fd));
+					_close = true;
+					return true;
+				}
+			} else
+				return true;
+			#ifdef DEBUG
+				logger::log("epoll", "DEBUG", "send " + std::to_string(count) + " bytes FD: " + std::to_string(fd));
+			#endif			
+			if (count > 0) {
+				advance(count);
+				continue;
+			}
+			if (count == -1 && errno == EINTR)
+				continue;
+			if (count == -1 && errno == EAGAIN)
+				return false;
+			logger::log("epoll", "error", std::string(__FUNCTION__) + " send() error: " + std::string(strerror(errno)) + " FD: " + std::to_string(fd));
+			return true;
+		}
+	}
+
 	request::request(int fdes, const char* ip): fd {fdes}, remote_ip {std::string(ip)}
 	{
 		#ifdef DEBUG
@@ -198,7 +951,6 @@ namespace http
 			ss << this;
 			logger::log("http", "DEBUG", " http::request constructor (" + ss.str() + ") - FD: " + std::to_string(fd));
 		#endif		
-		headers.reserve(10);
 		params.reserve(10);
 		payload.reserve(8191);
 	}
@@ -210,7 +962,6 @@ namespace http
 			ss << this;
 			logger::log("http", "DEBUG", " http::request default constructor (" + ss.str() + ") - FD: " + std::to_string(fd));
 		#endif		
-		headers.reserve(10);
 		params.reserve(10);
 		payload.reserve(8191);
 	}
@@ -228,7 +979,11 @@ namespace http
 	{
 		response.clear();
 		payload.clear();
-		headers.clear();
+		body.clear();
+		multipart.clear();
+		spill.clear();
+		known_headers.fill({});
+		other_headers_count = 0;
 		params.clear();
 		errcode = 0;
 		errmsg = "";
@@ -239,24 +994,23 @@ namespace http
 		cookie = "";
 		bodyStartPos = 0;
 		contentLength = 0;
+		receivedLength = 0;
 		method = "";
 		isMultipart = false;
 	}
 	
 	void request::parse() 
 	{
-		std::string_view str{payload};
-		bodyStartPos = str.find("\r\n\r\n") + 4;
-		line_reader lr(str.substr(0, bodyStartPos));
+		//single pass over the header block, the empty line that ends it marks the start of the body
+		line_reader lr(payload);
 	
-		if (bodyStartPos <= 4) {
+		size_t nextpos{0};
+		std::string_view line = lr.getline();
+		if (lr.eof) {
 			errcode = -1; 
 			errmsg.append("Bad request format");
 			return;
 		}
-	
-		size_t nextpos{0};
-		std::string_view line = lr.getline();
 		if (auto newpos = line.find(" ", 0); newpos != std::string::npos) {
 			method = line.substr( 0, newpos );
 			nextpos = newpos;
@@ -266,9 +1020,9 @@ namespace http
 			return;
 		}
 
-		if (method != "GET" && method != "POST") {
+		if (method != "GET" && method != "POST" && method != "OPTIONS") {
 			errcode = -1; 
-			errmsg.append("Bad request -> only GET-POST are supported: ").append(method);
+			errmsg.append("Bad request -> only GET-POST-OPTIONS are supported: ").append(method);
 			return;
 		}
 
@@ -286,92 +1040,186 @@ namespace http
 			path = queryString;
 		}
 
-		try {
-			while (!lr.eof) {
-				std::string_view line = lr.getline();
-				if (line.size()==0) break;
-				if (auto newpos = line.find(":", 0); newpos != std::string::npos) {
-					auto h = headers.emplace(lowercase( std::string(line.substr( 0,  newpos)) ), line.substr( newpos + 2,  line.size() - newpos + 2));
-					if (!h.second) {
-						errcode = -1; 
-						errmsg = "Bad request -> duplicated header in request: " + h.first->first + " " + path;
-					}
-					if (h.first->first == "content-length")
-						contentLength = std::stoul(h.first->second);
-					else if (h.first->first == "content-type") {
-						if ( h.first->second.starts_with("multipart") ) {
-							isMultipart = true;
-							boundary = h.first->second.substr( h.first->second.find("=") + 1 );
-						}
-					}
-					else if (h.first->first == "x-forwarded-for")
-					{
-						remote_ip = h.first->second;					
-					}
-					else if (h.first->first == "cookie") {
-						cookie = get_cookie( h.first->second );
-					}
-					else if (h.first->first == "origin") {
-						origin = h.first->second;
-						origin = origin.empty() ? "null":  origin;
-					}
-				} else {
+		while (true) {
+			std::string_view line = lr.getline();
+			if (lr.eof) {
+				errcode = -1; 
+				errmsg.append("Bad request format");
+				return;
+			}
+			if (line.size()==0) break;
+			if (auto newpos = scan::find_char(line, ':'); newpos != std::string::npos) {
+				std::string_view name {line.substr(0, newpos)};
+				std::string_view value {trim(line.substr(newpos + 1))};
+				if (other_headers_count == max_headers) {
 					errcode = -1; 
-					errmsg = "Bad request -> header lacks ':'";
+					errmsg = "Bad request -> too many headers in request: " + std::string(path);
 					return;
 				}
+				if (!add_header(name, value)) {
+					errcode = -1; 
+					errmsg = "Bad request -> duplicated header in request: " + std::string(name) + " " + std::string(path);
+					return;
+				}
+			} else {
+				errcode = -1; 
+				errmsg = "Bad request -> header lacks ':'";
+				return;
 			}
-		} catch (const std::exception& e) {
-			errcode = -1; errmsg = "Bad request -> runtime exception while parsing the headers: " + std::string(e.what());
-			return;
 		}
+
+		bodyStartPos = lr.position();
+
+		if (auto value = get_header(header::content_length); !value.empty()) {
+			auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), contentLength);
+			if (ec != std::errc() || ptr != value.data() + value.size()) {
+				errcode = -1; 
+				errmsg = "Bad request -> invalid content length: " + std::string(value);
+				return;
+			}
+		}
+		if (auto value = get_header(header::content_type); value.starts_with("multipart")) {
+			isMultipart = true;
+			if (auto pos = value.find("boundary="); pos != std::string::npos)
+				boundary = value.substr(pos + 9);
+		}
+		if (auto value = get_header(header::x_forwarded_for); !value.empty())
+			remote_ip = value;
+		if (auto value = get_header(header::cookie); !value.empty())
+			cookie = get_cookie(value);
+		if (auto value = get_header(header::origin); !value.empty())
+			origin = value;
+
 		if (method=="GET")
 			parse_query_string(queryString);
+
+		if (method == "OPTIONS" && contentLength > 0) {
+			errcode = -1; 
+			errmsg = "Bad request -> OPTIONS with a body: " + std::string(path);
+			return;
+		}
 		
 		if (contentLength <= 0 && method == "POST") {
 			errcode = -1; 
 			errmsg = "Bad request -> invalid content length: " + std::to_string(contentLength);
+			return;
 		}
 		
+		if (method == "POST" && contentLength > env::max_body_size()) {
+			errcode = payload_too_large; 
+			errmsg = "Payload too large -> content length: " + std::to_string(contentLength) + " " + std::string(path);
+			response.close_connection();
+			return;
+		}
+
+		if (isMultipart && !multipart.start(boundary)) {
+			errcode = -1; 
+			errmsg = "Bad request -> invalid multipart boundary: " + std::string(boundary);
+			return;
+		}
+
+		//body bytes received with the headers
+		if (method == "POST")
+			add_body(payload.data() + bodyStartPos, payload.size() - bodyStartPos);
+	}
+
+	//multipart bodies are parsed as they arrive, anything else is buffered for the microservice
+	void request::add_body(const char* data, size_t len)
+	{
+		len = std::min(len, contentLength - receivedLength);
+		receivedLength += len;
+		if (!isMultipart) {
+			if (contentLength > body_spill_size && (spill.is_open() || spill.open())) {
+				if (!spill.write(data, len)) {
+					errcode = -1; 
+					errmsg = "Bad request -> cannot store request body: " + std::string(path);
+				}
+			} else
+				body.append(data, len);
+			return;
+		}
+		if (errcode == 0 && !multipart.feed(std::string_view(data, len), params)) {
+			errcode = -1; 
+			errmsg = "Bad request -> invalid multipart body: " + std::string(path);
+		}
+	}
+
+	//returns false if the header is duplicated
+	bool request::add_header(std::string_view name, std::string_view value) noexcept
+	{
+		const uint32_t hash {header_hash(name)};
+		if (auto id = get_header_id(name, hash); id != header::count) {
+			auto& slot = known_headers[static_cast<size_t>(id)];
+			if (slot.data() != nullptr) //a header with empty value is still present
+				return false;
+			slot = value;
+			return true;
+		}
+		for (size_t i = 0; i < other_headers_count; i++)
+			if (other_headers[i].hash == hash && iequals(other_headers[i].name, name))
+				return false;
+		other_headers[other_headers_count++] = {name, value, hash};
+		return true;
 	}
 	
+	std::string_view request::get_body() noexcept
+	{
+		if (spill.is_open())
+			return spill.view();
+		return body;
+	}
+
 	bool request::eof() 
 	{
-		if ( (payload.size() - bodyStartPos) == contentLength ) {
-			
-			if (method == "POST") {
-				auto fields = parse_multipart();
-				bool _save {true};
-				for (auto& f: fields) {
-					if (f.filename.empty()) {
-						params.emplace(f.name, f.data);
-						if (f.name=="title" && f.data.empty())
-							_save = false;
-					} else {
-						std::string file_uuid {get_uuid()};
-						params.emplace( "document", file_uuid);
-						params.emplace( "content_len", std::to_string( f.data.size() ) );
-						params.emplace( "content_type", f.content_type);
-						params.emplace( "filename", f.filename);
-						if (_save)
-							save_blob(file_uuid, f.data);
-					}
-				}
-			}
-		
+		if (errcode == -1) {
+			//the rest of the body won't be read, the connection can't be reused
+			if (receivedLength < contentLength)
+				response.close_connection();
 			return true;
 		}
-		else
+		if (receivedLength < contentLength)
 			return false;
+		if (isMultipart && !multipart.done()) {
+			errcode = -1; 
+			errmsg = "Bad request -> incomplete multipart body: " + std::string(path);
+		} else if (!isMultipart)
+			parse_body();
+		return true;
+	}
+
+	//urlencoded and JSON object bodies fill params the same way as a query string,
+	//a JSON array body is left to the service, like the entries of /ms/batch
+	void request::parse_body() noexcept
+	{
+		const std::string_view content_type {get_header(header::content_type)};
+		if (content_type.starts_with("application/x-www-form-urlencoded")) {
+			parse_form(get_body());
+		} else if (content_type.starts_with("application/json")) {
+			const std::string_view body {get_body()};
+			if (const size_t pos {body.find_first_not_of(" \t\r\n")}; pos != std::string_view::npos && body[pos] == '[')
+				return;
+			if (!parse_json_object(body, params)) {
+				errcode = -1; 
+				errmsg = "Bad request -> invalid JSON body: " + std::string(path);
+			}
+		}
 	}
 	
 	
-	std::string request::get_header(const std::string& name) const 
+	std::string_view request::get_header(header h) const noexcept
 	{
-		if (auto value = headers.find(name); value != headers.end()) 
-			return value->second;
-		else
-			return "";
+		return known_headers[static_cast<size_t>(h)];
+	}
+
+	std::string_view request::get_header(std::string_view name) const noexcept
+	{
+		const uint32_t hash {header_hash(name)};
+		if (auto id = get_header_id(name, hash); id != header::count) 
+			return known_headers[static_cast<size_t>(id)];
+		for (size_t i = 0; i < other_headers_count; i++)
+			if (other_headers[i].hash == hash && iequals(other_headers[i].name, name))
+				return other_headers[i].value;
+		return "";
 	}
 
 	std::string_view request::get_cookie(std::string_view cookieHdr) 
@@ -388,168 +1236,406 @@ namespace http
 			return "";
 	}
 
-	std::string request::lowercase(std::string s) noexcept 
+	std::string request::decode_param(std::string_view value) noexcept 
 	{
-		std::transform( s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); } );
-		return s;
-	}	
+		std::string result;
+		scan::url_decode(value, result);
+		return result;
+	}
 
-	std::string request::decode_param(const std::string &value) noexcept 
+	void request::parse_query_string(std::string_view qs) noexcept 
 	{
-	  std::string result;
-	  result.reserve(value.size() / 3 + (value.size() % 3)); // Minimum size of result
+		if(qs.empty())
+			return;
 
-	  for(std::size_t i = 0; i < value.size(); ++i) {
-		auto &chr = value[i];
-		if(chr == '%' && i + 2 < value.size()) {
-		  auto hex = value.substr(i + 1, 2);
-		  auto decoded_chr = static_cast<char>(std::strtol(hex.c_str(), nullptr, 16));
-		  result += decoded_chr;
-		  i += 2;
+		if (auto pos = scan::find_char(qs, '?'); pos != std::string::npos)
+			parse_form(qs.substr(pos + 1));
+	}
+
+	//name=value&name=value..., used for query strings and urlencoded bodies
+	void request::parse_form(std::string_view form) noexcept 
+	{
+		size_t name_pos {0};
+		while (name_pos < form.size()) {
+			size_t value_end {std::string::npos};
+			std::string_view name;
+			std::string value;
+			if (auto d = scan::find_first_of(form, '&', '=', name_pos); d != std::string::npos && form[d] == '=') {
+				name = form.substr(name_pos, d - name_pos);
+				value_end = scan::find_char(form, '&', d + 1);
+				if (!name.empty())
+					value = decode_param(form.substr(d + 1, value_end - d - 1));
+			} else {
+				name = form.substr(name_pos, d - name_pos);
+				value_end = d;
+			}
+			if (!name.empty())
+				params.emplace(name, std::move(value));
+			if (value_end == std::string::npos)
+				break;
+			name_pos = value_end + 1;
 		}
-		else if(chr == '+')
-		  result += ' ';
-		else
-		  result += chr;
-	  }
+	}	
+	
+	multipart_parser::multipart_parser(multipart_parser&& other) noexcept
+	{
+		*this = std::move(other);
+	}
 
-	  return result;
+	multipart_parser& multipart_parser::operator=(multipart_parser&& other) noexcept
+	{
+		if (this != &other) {
+			clear();
+			_state = other._state;
+			_delimiter = std::move(other._delimiter);
+			_carry = std::move(other._carry);
+			_name = std::move(other._name);
+			_filename = std::move(other._filename);
+			_content_type = std::move(other._content_type);
+			_document = std::move(other._document);
+			_value = std::move(other._value);
+			_size = other._size;
+			_fd = std::exchange(other._fd, -1);
+			_save = other._save;
+		}
+		return *this;
 	}
 
-	void request::parse_query_string(std::string_view qs) noexcept 
+	multipart_parser::~multipart_parser()
 	{
+		close_blob(true);
+	}
 
-		if(qs.empty())
-			return;
+	//boundary is the value of the boundary attribute of the content-type header
+	bool multipart_parser::start(std::string_view boundary) noexcept
+	{
+		if (auto pos = scan::find_char(boundary, ';'); pos != std::string::npos)
+			boundary = trim(boundary.substr(0, pos));
+		if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"')
+			boundary = boundary.substr(1, boundary.size() - 2);
+		if (boundary.empty() || boundary.size() > 70)
+			return false;
+		_delimiter.assign("\r\n--").append(boundary);
+		//the first boundary is not preceded by CRLF
+		_carry.assign("\r\n");
+		_state = state::preamble;
+		return true;
+	}
 
-		if (auto pos = qs.find("?"); pos == std::string::npos)
-			return;
-		else {
-			std::string_view query_string = qs.substr(pos + 1);
-			std::size_t name_pos = 0;
-			auto name_end_pos = std::string::npos;
-			auto value_pos = std::string::npos;
-			for(std::size_t c = 0; c < query_string.size(); ++c) {
-			if(query_string[c] == '&') {
-					auto name = query_string.substr(name_pos, (name_end_pos == std::string::npos ? c : name_end_pos) - name_pos);
-					if(!name.empty()) {
-					auto value = value_pos == std::string::npos ? std::string() : query_string.substr(value_pos, c - value_pos);
-					params.emplace(std::move(name), decode_param(std::string(value)));
-				}
-				name_pos = c + 1;
-					name_end_pos = std::string::npos;
-					value_pos = std::string::npos;
-				}
-				else if(query_string[c] == '=' && name_end_pos == std::string::npos) {
-					name_end_pos = c;
-					value_pos = c + 1;
+	//returns false if the body is not valid multipart content
+	bool multipart_parser::feed(std::string_view data, std::unordered_map<std::string, std::string>& params) noexcept
+	{
+		while (!_carry.empty() && !data.empty() && _state != state::error) {
+			//top up the carry with just enough bytes to resolve a delimiter split between reads
+			const size_t held {_carry.size()};
+			const size_t take {(_state == state::headers) ? data.size() : std::min(data.size(), _delimiter.size() + 2)};
+			_carry.append(data.data(), take);
+			const size_t used {consume(_carry, params)};
+			if (used >= held) {
+				//what is left in the carry came from data, keep scanning it there
+				data.remove_prefix(used - held);
+				_carry.clear();
+			} else {
+				_carry.erase(0, used);
+				data.remove_prefix(take);
+			}
+		}
+		if (_carry.empty() && !data.empty() && _state != state::error)
+			_carry.assign(data.substr(consume(data, params)));
+		return _state != state::error;
+	}
+
+	bool multipart_parser::done() const noexcept
+	{
+		return _state == state::epilogue;
+	}
+
+	//a blob that was not completely received is removed
+	void multipart_parser::clear() noexcept
+	{
+		close_blob(true);
+		_state = state::preamble;
+		_delimiter.clear();
+		_carry.clear();
+		_name.clear();
+		_filename.clear();
+		_content_type.clear();
+		_document.clear();
+		_value.clear();
+		_size = 0;
+		_save = true;
+	}
+
+	//returns the number of bytes consumed, stops when more input is required to make progress
+	size_t multipart_parser::consume(std::string_view data, std::unordered_map<std::string, std::string>& params) noexcept
+	{
+		size_t pos {0};
+		while (pos < data.size()) {
+			std::string_view in {data.substr(pos)};
+			switch (_state) {
+				case state::preamble:
+				case state::data:
+					if (auto p = in.find(_delimiter); p != std::string::npos) {
+						if (_state == state::data) {
+							write_part(in.substr(0, p));
+							end_part(params);
+						}
+						pos += p + _delimiter.size();
+						_state = state::boundary_end;
+					} else {
+						//the tail may hold the beginning of a delimiter
+						if (in.size() < _delimiter.size())
+							return pos;
+						const size_t safe {in.size() - _delimiter.size() + 1};
+						if (_state == state::data)
+							write_part(in.substr(0, safe));
+						return pos + safe;
+					}
+					break;
+				case state::boundary_end:
+					if (in.size() < 2)
+						return pos;
+					if (in.starts_with("--")) {
+						_state = state::epilogue;
+					} else if (in.starts_with("\r\n")) {
+						_state = state::headers;
+					} else {
+						_state = state::error;
+						return pos;
+					}
+					pos += 2;
+					break;
+				case state::headers: {
+					std::string_view headers;
+					size_t len {2};
+					if (!in.starts_with("\r\n")) {
+						auto p = in.find("\r\n\r\n");
+						if (p == std::string::npos || p > max_part_header) {
+							if (in.size() > max_part_header)
+								_state = state::error;
+							return pos;
+						}
+						headers = in.substr(0, p + 2);
+						len = p + 4;
+					}
+					if (!begin_part(headers)) {
+						_state = state::error;
+						return pos;
+					}
+					pos += len;
+					_state = state::data;
+					break;
 				}
+				case state::epilogue:
+					return data.size();
+				case state::error:
+					return pos;
+			}
+		}
+		return pos;
+	}
+
+	//Content-Disposition: form-data; name="file1"; filename="a.txt"
+	bool multipart_parser::begin_part(std::string_view headers) noexcept
+	{
+		_name.clear();
+		_filename.clear();
+		_content_type.clear();
+		_document.clear();
+		_value.clear();
+		_size = 0;
+
+		size_t pos {0};
+		while (pos < headers.size()) {
+			size_t end {scan::find_crlf(headers, pos)};
+			if (end == std::string::npos)
+				end = headers.size();
+			std::string_view line {headers.substr(pos, end - pos)};
+			pos = end + 2;
+			const size_t colon {scan::find_char(line, ':')};
+			if (colon == std::string::npos)
+				return false;
+			const std::string_view name {trim(line.substr(0, colon))};
+			const std::string_view value {trim(line.substr(colon + 1))};
+			if (iequals(name, "content-type")) {
+				_content_type = value;
+				continue;
 			}
-			if(name_pos < query_string.size()) {
-				auto name = query_string.substr(name_pos, (name_end_pos == std::string::npos ? std::string::npos : name_end_pos - name_pos));
-				if(!name.empty()) {
-				  auto value = value_pos >= query_string.size() ? std::string() : query_string.substr(value_pos);
-				  params.emplace(std::move(name), decode_param(std::string(value)));
+			if (!iequals(name, "content-disposition"))
+				continue;
+			size_t i {0};
+			while (i < value.size()) {
+				const size_t semi {std::min(scan::find_first_of(value, ';', '=', i), value.size())};
+				const std::string_view key {trim(value.substr(i, semi - i))};
+				i = semi + 1;
+				if (semi == value.size() || value[semi] == ';')
+					continue;
+				std::string_view attr;
+				while (i < value.size() && value[i] == ' ')
+					i++;
+				if (i < value.size() && value[i] == '"') {
+					const size_t quote {std::min(scan::find_char(value, '"', i + 1), value.size())};
+					attr = value.substr(i + 1, quote - i - 1);
+					i = std::min(scan::find_char(value, ';', quote), value.size()) + 1;
+				} else {
+					const size_t next {std::min(scan::find_char(value, ';', i), value.size())};
+					attr = trim(value.substr(i, next - i));
+					i = next + 1;
 				}
+				if (iequals(key, "name"))
+					_name = attr;
+				else if (iequals(key, "filename"))
+					_filename = attr;
 			}
+		}
+
+		if (!_filename.empty()) {
+			_document = get_uuid();
+			if (_save && !_name.empty()) {
+				const std::string blob {blob_path + _document};
+				_fd = open(blob.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				if (_fd == -1)
+					logger::log("http", "error",  std::string(__PRETTY_FUNCTION__) +  " cannot write to file: " + blob + " " + std::string(strerror(errno)), true);
+			}
+		}
+		return true;
+	}
+
+	void multipart_parser::write_part(std::string_view data) noexcept
+	{
+		if (_filename.empty()) {
+			_value.append(data);
 			return;
 		}
-		
-	}	
-	
-	std::string request::get_part_content_type(std::string value) 
+		_size += data.size();
+		while (_fd != -1 && !data.empty()) {
+			if (ssize_t count = write(_fd, data.data(), data.size()); count > 0) {
+				data.remove_prefix(count);
+			} else if (count == -1 && errno == EINTR) {
+				continue;
+			} else {
+				logger::log("http", "error",  std::string(__PRETTY_FUNCTION__) +  " cannot write to file: " + blob_path + _document + " " + std::string(strerror(errno)), true);
+				close_blob(true);
+			}
+		}
+	}
+
+	//a part without name is ignored, an empty "title" field means the file parts that follow are not saved
+	void multipart_parser::end_part(std::unordered_map<std::string, std::string>& params) noexcept
 	{
-		if (auto pos = value.find(": "); pos != std::string::npos) {
-			value.erase(0, pos + 1);
-			value.pop_back();
+		if (_name.empty())
+			return;
+		if (_filename.empty()) {
+			if (_name == "title" && _value.empty())
+				_save = false;
+			params.emplace(_name, std::move(_value));
+			_value.clear();
+			return;
 		}
-		return value;
-	}	
-	
-	std::pair<std::string, std::string> request::get_part_field(std::string value) 
+		close_blob(false);
+		params.emplace("document", _document);
+		params.emplace("content_len", std::to_string(_size));
+		params.emplace("content_type", _content_type);
+		params.emplace("filename", _filename);
+	}
+
+	void multipart_parser::close_blob(bool remove) noexcept
 	{
-		
-		std::string token_name{"name=\""};
-		std::string token_filename{"filename=\""};
-		std::string name = value;
-		std::string filename = value;
-		
-		//Content-Disposition: form-data; name="file1"; filename="a.txt"
-		if (auto pos = name.find(token_name); pos!=std::string::npos) {
-			name.erase(0, pos + token_name.size());
-			if (auto pos2 = name.find("\""); pos2!=std::string::npos)
-				name.erase(pos2);
-		} else
-			name = "";
+		if (_fd == -1)
+			return;
+		close(_fd);
+		_fd = -1;
+		if (remove)
+			unlink((blob_path + _document).c_str());
+	}
 
-		if (auto pos = filename.find(token_filename); pos!=std::string::npos) {
-			filename.erase(0, pos + token_filename.size());
-			if (auto pos2 = filename.find("\""); pos2!=std::string::npos)
-				filename.erase(pos2);
-		} else
-			filename = "";
-		
-		return std::pair<std::string, std::string>(name, filename);
-		
+	body_spill::body_spill(body_spill&& other) noexcept
+	{
+		*this = std::move(other);
 	}
 
-	std::vector<form_field> request::parse_multipart() 
+	body_spill& body_spill::operator=(body_spill&& other) noexcept
 	{
+		if (this != &other) {
+			clear();
+			_fd = std::exchange(other._fd, -1);
+			_size = std::exchange(other._size, 0);
+			_map = std::exchange(other._map, nullptr);
+		}
+		return *this;
+	}
 
-		std::string _boundary{ "--" + boundary };
-		std::string endBoundary{_boundary + "--"};
-		
-		std::vector<form_field> fields;
-		fields.reserve(4);
-		
-		std::string dataBuffer;
-		dataBuffer.reserve(131071);
-		std::pair<std::string, std::string> field;
-		std::string s;
-		std::istringstream is( payload.substr(bodyStartPos) );
-		std::string contentType{""};
-		
-		while ( getline(is, s) ) {
-			if (s.starts_with(_boundary)) //remove '\r'
-				s.pop_back();
-			if (s==_boundary) {
-				if (!field.first.empty()) {
-					if ( !field.second.empty() && dataBuffer.size() ) { 
-						//trim extra \r\n in file fields
-						dataBuffer.pop_back(); 
-						dataBuffer.pop_back();
-					}
-					fields.emplace_back(field.first, field.second, contentType, dataBuffer);
-					field.first = ""; field.second = ""; contentType=""; dataBuffer.clear();
-				}
-				getline(is, s); //read Content-Disposition
-				field = get_part_field(s);
-				if (!field.second.empty()) {
-					getline(is, s); //content-type
-					contentType = get_part_content_type(s);
-				} else {
-					contentType = "";
-				}
-				getline(is, s); //skip \r\n	
+	body_spill::~body_spill()
+	{
+		clear();
+	}
+
+	//the file has no name, it is released when the fd gets closed
+	bool body_spill::open() noexcept
+	{
+		_fd = ::open(spill_path.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+		if (_fd == -1) {
+			logger::log("http", "error",  std::string(__PRETTY_FUNCTION__) +  " cannot create temp file in: " + spill_path + " " + std::string(strerror(errno)), true);
+			return false;
+		}
+		return true;
+	}
+
+	bool body_spill::write(const char* data, size_t len) noexcept
+	{
+		while (len > 0) {
+			if (ssize_t count = ::write(_fd, data, len); count > 0) {
+				data += count;
+				len -= count;
+				_size += count;
+			} else if (count == -1 && errno == EINTR) {
 				continue;
-			} else if (s==endBoundary) {
-				if (!field.first.empty()) {
-					if ( !field.second.empty() && dataBuffer.size() ) {
-						//trim extra \r\n in file fields
-						dataBuffer.pop_back(); 
-						dataBuffer.pop_back();
-					}
-					fields.emplace_back(field.first, field.second, contentType, dataBuffer);
-					field.first = ""; field.second = ""; contentType=""; dataBuffer.clear();
-				}			
 			} else {
-				if (s.size() && s.back() == '\r' && field.second.empty())
-					s.pop_back(); //remove '\r' if it is not a file field
-				dataBuffer.append(s);
-				if (!field.second.empty())
-					dataBuffer.append("\n");
+				logger::log("http", "error",  std::string(__PRETTY_FUNCTION__) +  " cannot write to temp file: " + std::string(strerror(errno)), true);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::string_view body_spill::view() noexcept
+	{
+		if (_size == 0)
+			return "";
+		if (_map == nullptr) {
+			_map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+			if (_map == MAP_FAILED) {
+				_map = nullptr;
+				logger::log("http", "error",  std::string(__PRETTY_FUNCTION__) +  " mmap() failed: " + std::string(strerror(errno)), true);
+				return "";
 			}
 		}
-		return fields;
+		return std::string_view(static_cast<const char*>(_map), _size);
+	}
+
+	bool body_spill::is_open() const noexcept
+	{
+		return _fd != -1;
+	}
+
+	int body_spill::fd() const noexcept
+	{
+		return _fd;
+	}
+
+	size_t body_spill::size() const noexcept
+	{
+		return _size;
+	}
+
+	void body_spill::clear() noexcept
+	{
+		if (_map != nullptr)
+			munmap(_map, _size);
+		if (_fd != -1)
+			close(_fd);
+		_map = nullptr;
+		_fd = -1;
+		_size = 0;
 	}
 }
\ No newline at end of file
@@ -21,78 +21,264 @@
 #include <vector>
 #include <sstream>
 #include <iomanip>
+#include <ctime>
 #include <cstring>
+#include <array>
+#include <charconv>
+#include <utility>
+#include <memory>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include "env.h"
 #include "logger.h"
+#include "scan.h"
 
 namespace http
 {
 	const std::string blob_path {"/var/blobs/"};
+	const std::string spill_path {"/tmp"}; //directory for the temp files of large request bodies
+	constexpr size_t chunk_size {16384}; //flush threshold for chunked responses
+	constexpr int send_timeout {30000}; //max milliseconds to wait for a full socket buffer to drain
+	constexpr size_t max_headers {64}; //request headers not listed in http::header
+	constexpr size_t max_part_header {8192}; //max size of the header block of a multipart part
+	constexpr size_t body_spill_size {262144}; //larger request bodies are kept in a temp file instead of the heap
+	constexpr int payload_too_large {413}; //request::errcode when content length exceeds CPP_MAX_BODY_SIZE
+	constexpr int compression_level {1}; //JSON with repeated keys compresses ~12x at level 1, higher levels cost 2x CPU for ~15%
 	
-	std::string get_content_type(const std::string& filename) noexcept;
-	std::string get_response_date() noexcept;
+	std::string_view get_content_type(std::string_view filename) noexcept;
+	//flat JSON object into name/value pairs, nested objects and arrays are kept as JSON text, returns false if malformed
+	bool parse_json_object(std::string_view json, std::unordered_map<std::string, std::string>& params) noexcept;
+	//elements of a JSON array, objects and arrays as JSON text and scalars like parse_json_object, returns false if malformed
+	bool parse_json_array(std::string_view json, std::vector<std::string>& items) noexcept;
+	std::string_view get_response_date() noexcept;
+	std::string format_http_date(std::time_t t) noexcept;
+	//IMF-fixdate as sent in If-Modified-Since and If-Range, -1 if malformed
+	std::time_t parse_http_date(std::string_view date) noexcept;
+
+	struct byte_range {
+		size_t first;
+		size_t length;
+	};
+	constexpr size_t max_ranges {16}; //a Range header with more ranges is ignored and the whole file is sent
+	//satisfiable ranges of a file of the given size, false if the header must be ignored,
+	//true with no ranges if none of them can be satisfied (416)
+	bool parse_range(std::string_view header, size_t size, std::vector<byte_range>& ranges) noexcept;
+
+	//1 if value is listed in an Accept style header, 0 if it is listed with q=0, -1 if it is not listed
+	int find_accepted(std::string_view header, std::string_view value) noexcept;
+
+	enum class content_encoding : unsigned char { identity, gzip, deflate };
+	content_encoding get_content_encoding(std::string_view accept_encoding) noexcept;
+	std::string_view get_encoding_name(content_encoding enc) noexcept;
+	bool is_compressible(std::string_view content_type) noexcept;
+	uint64_t hash64(std::string_view data, uint64_t seed = 0) noexcept;
+	//weak entity tag W/"<hash64 in hex>"
+	std::string get_etag(std::string_view data) noexcept;
+	//weak comparison against an If-None-Match list
+	bool etag_matches(std::string_view if_none_match, std::string_view etag) noexcept;
+	//appends the compressed data to out using the calling thread's z_stream, start resets the stream,
+	//finish ends it, a response sent in chunks calls it once per chunk
+	bool compress(content_encoding enc, std::string_view data, std::string& out, bool start, bool finish) noexcept;
 	
-	struct form_field 
-	{
-		std::string name;
-		std::string filename;
-		std::string content_type;
-		std::string data;
+	//incremental multipart/form-data parser, fed by the epoll loop as the body arrives,
+	//file parts are written straight to blob_path, only a small carry buffer is kept between reads
+	struct multipart_parser {
+	  public:
+		multipart_parser() = default;
+		multipart_parser(const multipart_parser&) = delete;
+		multipart_parser& operator=(const multipart_parser&) = delete;
+		multipart_parser(multipart_parser&& other) noexcept;
+		multipart_parser& operator=(multipart_parser&& other) noexcept;
+		~multipart_parser();
+		bool start(std::string_view boundary) noexcept;
+		bool feed(std::string_view data, std::unordered_map<std::string, std::string>& params) noexcept;
+		bool done() const noexcept;
+		void clear() noexcept;
+	  private:
+		enum class state : unsigned char { preamble, boundary_end, headers, data, epilogue, error };
+		state _state {state::preamble};
+		std::string _delimiter; //CRLF + "--" + boundary
+		std::string _carry; //unconsumed bytes from the previous read
+		std::string _name;
+		std::string _filename;
+		std::string _content_type;
+		std::string _document;
+		std::string _value; //content of a non-file part
+		size_t _size {0};
+		int _fd {-1};
+		bool _save {true};
+		size_t consume(std::string_view data, std::unordered_map<std::string, std::string>& params) noexcept;
+		bool begin_part(std::string_view headers) noexcept;
+		void write_part(std::string_view data) noexcept;
+		void end_part(std::unordered_map<std::string, std::string>& params) noexcept;
+		void close_blob(bool remove) noexcept;
+	};
+
+	//request body stored in an unlinked temp file, mapped into memory when the microservice reads it
+	struct body_spill {
+	  public:
+		body_spill() = default;
+		body_spill(const body_spill&) = delete;
+		body_spill& operator=(const body_spill&) = delete;
+		body_spill(body_spill&& other) noexcept;
+		body_spill& operator=(body_spill&& other) noexcept;
+		~body_spill();
+		bool open() noexcept;
+		bool write(const char* data, size_t len) noexcept;
+		std::string_view view() noexcept;
+		bool is_open() const noexcept;
+		int fd() const noexcept;
+		size_t size() const noexcept;
+		void clear() noexcept;
+	  private:
+		int _fd {-1};
+		size_t _size {0};
+		void* _map {nullptr};
 	};
 
 	struct response_stream {
 	  public:	
 		response_stream(int size);
 		response_stream();
-		response_stream& operator <<(std::string data);
+		response_stream& operator <<(const std::string& data);
+		response_stream& operator <<(std::string_view data);
 		response_stream& operator <<(const char* data);
 		response_stream& operator <<(size_t data);
 		std::string_view view() noexcept;
 		size_t size() noexcept;
 		const char* c_str() noexcept;
 		void append(const char* data, size_t len) noexcept;
+		void attach(std::shared_ptr<const void> owner, std::string_view body) noexcept;
+		void set_file(int fd) noexcept;
+		void attach_file(off_t offset, size_t length) noexcept;
 		const char* data() noexcept;
 		void clear() noexcept;
 		bool write(int fd) noexcept; 
+		void begin_chunked(int fd) noexcept;
+		bool write_chunk(std::string_view data) noexcept;
+		bool end_chunked() noexcept;
+		bool flush() noexcept;
+		bool is_chunked() const noexcept;
+		void close_connection() noexcept;
+		bool must_close() const noexcept;
 	  private:
-		int _pos1 {0};
+		size_t _pos1 {0};
+		int _fd {-1};
+		bool _chunked {false};
+		bool _failed {false};
+		bool _close {false};
 		std::string _buffer{""};
+		//body pieces sent after _buffer[0, at), from memory or from _file with sendfile if data is null
+		struct segment {
+			size_t at;
+			const char* data;
+			off_t offset;
+			size_t length;
+		};
+		//closes the file when the response is cleared or destroyed
+		struct file_ref {
+			int fd {-1};
+			file_ref() = default;
+			file_ref(const file_ref&) = delete;
+			file_ref& operator=(const file_ref&) = delete;
+			file_ref(file_ref&& other) noexcept;
+			file_ref& operator=(file_ref&& other) noexcept;
+			~file_ref();
+			void reset() noexcept;
+		};
+		std::vector<segment> _segments;
+		size_t _segment {0};
+		size_t _segment_pos {0};
+		std::shared_ptr<const void> _owner;
+		file_ref _file;
+		void add_segment(const char* data, off_t offset, size_t length) noexcept;
+		void advance(size_t count) noexcept;
 	};
 	
+	//common request headers, resolved to a fixed slot while parsing
+	enum class header : unsigned char {
+		host,
+		user_agent,
+		accept,
+		accept_encoding,
+		accept_language,
+		connection,
+		content_length,
+		content_type,
+		cookie,
+		origin,
+		referer,
+		expect,
+		if_none_match,
+		if_modified_since,
+		if_range,
+		range,
+		access_control_request_method,
+		access_control_request_headers,
+		x_forwarded_for,
+		x_request_id,
+		count
+	};
+
+	struct header_field 
+	{
+		std::string_view name;
+		std::string_view value;
+		uint32_t hash {0};
+	};
+
+	//method, path, headers, etc. are views over the request's header block (payload), which is not modified
+	//after parse(), the body is kept in a separate buffer
 	struct request {
 	  public:
 		int fd; //socket fd
 		size_t bodyStartPos{0};
 		size_t contentLength{0};
+		size_t receivedLength{0}; //body bytes received so far
 		bool isMultipart{false};
-		std::string method{""};
-		std::string queryString{""};
-		std::string path{""};
-		std::string boundary{""};
-		std::string cookie{""};
+		std::string_view method{""};
+		std::string_view queryString{""};
+		std::string_view path{""};
+		std::string_view boundary{""};
+		std::string_view cookie{""};
 		int errcode{0};
 		std::string errmsg{""};
 		std::string remote_ip;
-		std::string origin{"null"};
+		std::string_view origin{"null"};
 		std::string payload;
-		std::unordered_map<std::string, std::string> headers;
+		std::string body; //bodies up to body_spill_size, use get_body() to read any body
 		std::unordered_map<std::string, std::string> params;
 		response_stream response;
 		request();
 		request(int fdes, const char* ip);
+		request(request&& other) = default;
+		request& operator=(request&& other) = default;
 		~request();
 		void clear();
 		void parse();
+		void add_body(const char* data, size_t len);
+		std::string_view get_body() noexcept;
 		bool eof();
-		std::string get_header(const std::string& name) const;
+		std::string_view get_header(header h) const noexcept;
+		std::string_view get_header(std::string_view name) const noexcept;
 	  private:
+		std::array<std::string_view, static_cast<size_t>(header::count)> known_headers{};
+		std::array<header_field, max_headers> other_headers{};
+		size_t other_headers_count{0};
+		multipart_parser multipart;
+		body_spill spill;
+		bool add_header(std::string_view name, std::string_view value) noexcept;
 		std::string_view get_cookie(std::string_view cookieHdr);
-		std::string lowercase(std::string s) noexcept;	
-		std::string decode_param(const std::string &value) noexcept;
+		std::string decode_param(std::string_view value) noexcept;
 		void parse_query_string(std::string_view qs) noexcept;	
-		std::string get_part_content_type(std::string value);
-		std::pair<std::string, std::string> get_part_field(std::string value);
-		std::vector<form_field> parse_multipart();
+		void parse_form(std::string_view form) noexcept;
+		void parse_body() noexcept;
 	};	
 }
 
@@ -47,12 +47,24 @@ int m_signal;
 inline bool read_request(http::request& req, const char* data, int bytes) noexcept
 {
 	bool first_packet { (req.payload.size() > 0) ? false : true };
-	req.payload.append(data, bytes);
 	if (first_packet) {
+		req.payload.append(data, bytes);
 		req.parse();
-		if (req.method == "GET" || req.errcode ==  -1)
+		if (req.errcode != 0) {
+			//the rest of the body won't be read, it would be parsed as the next request
+			if (req.receivedLength < req.contentLength)
+				req.response.close_connection();
 			return true;
-	}
+		}
+		if (req.method != "POST")
+			return true;
+		//the client waits for this before sending the body, a body that would be refused never leaves the client
+		if (req.get_header(http::header::expect) == "100-continue" && req.receivedLength < req.contentLength) {
+			constexpr std::string_view msg {"HTTP/1.1 100 Continue\r\n\r\n"};
+			send(req.fd, msg.data(), msg.size(), MSG_NOSIGNAL);
+		}
+	} else
+		req.add_body(data, bytes);
 	if (req.eof())
 		return true;
 	return false;
@@ -115,14 +127,14 @@ void consumer(std::stop_token tok) noexcept
 		//---processing task (run microservice)
 		mse::http_server(params.fd, params.req);
 		
-		//request ready, set epoll fd for output
+		//request ready, give the fd back to epoll for output, a peer that closed meanwhile is reported right away
 		#ifdef DEBUG
 			logger::log("epoll", "DEBUG", "consumer thread setting mode to epollout FD: " + std::to_string(params.fd), true);
 		#endif			
 		epoll_event event;
 		event.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
 		event.data.ptr = &params.req;
-		epoll_ctl(params.epoll_fd, EPOLL_CTL_MOD, params.fd, &event);
+		epoll_ctl(params.epoll_fd, EPOLL_CTL_ADD, params.fd, &event);
 	}
 	
 	//ending task - free resources
@@ -147,6 +159,14 @@ void start_epoll(int port) noexcept
 	event_signal.events = EPOLLIN;
 	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, m_signal, &event_signal);
 
+	const int inotify_fd {filecache::start()};
+	if (inotify_fd != -1) {
+		epoll_event event_inotify;
+		event_inotify.data.fd = inotify_fd;
+		event_inotify.events = EPOLLIN;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event_inotify);
+	}
+
 	std::array<char, 8192> data{};
 	std::unordered_map<int, http::request> buffers;
 	buffers.reserve(1500);
@@ -185,6 +205,10 @@ void start_epoll(int port) noexcept
 				exit_loop = true;
 				break;
 			}
+			else if (inotify_fd != -1 && inotify_fd == events[i].data.fd) //static file changed
+			{
+				filecache::on_notify();
+			}
 			else if (listen_fd == events[i].data.fd) // new connection.
 			{
 				struct sockaddr addr;
@@ -249,10 +273,21 @@ void start_epoll(int port) noexcept
 							break;
 						}
 					}
-					if (run_task) {
+					if (run_task && (mse::serve_preflight(req) || mse::serve_cached(req))) {
+						#ifdef DEBUG
+							logger::log("epoll", "DEBUG", "answered by the epoll thread, setting mode to epollout FD: " + std::to_string(fd));
+						#endif
+						epoll_event event;
+						event.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
+						event.data.ptr = &req;
+						epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+					} else if (run_task) {
 						#ifdef DEBUG
 							logger::log("epoll", "DEBUG", "dispatching task FD: " + std::to_string(fd));
 						#endif
+						//the worker owns the fd and the request until it adds the fd back, if epoll closed it on a hang-up
+						//accept4 could reuse the number and replace the request the worker is still writing to
+						epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
 						//producer
 						worker_params wp {epoll_fd, fd, req};
 						{
@@ -267,6 +302,15 @@ void start_epoll(int port) noexcept
 					#endif				
 					//send response
 					if (req.response.write(fd)) {
+						if (req.response.must_close()) {
+							req.clear();
+							close(fd);
+							mse::update_connections(-1);
+							#ifdef DEBUG
+								logger::log("epoll", "DEBUG", "write complete, closing FD: " + std::to_string(fd));
+							#endif
+							continue;
+						}
 						req.clear();
 						#ifdef DEBUG
 							logger::log("epoll", "DEBUG", "write complete, setting mode to epollin FD: " + std::to_string(fd));
@@ -283,6 +327,8 @@ void start_epoll(int port) noexcept
 			break;
 	}
 
+	if (inotify_fd != -1)
+		close(inotify_fd);
 	close(listen_fd);
 	logger::log("epoll", "info", "closing listen socket FD: " + std::to_string(listen_fd));
 	close(epoll_fd);
@@ -295,11 +341,15 @@ void print_server_info(std::string pod_name) noexcept
 	logger::log("env", "info", "pool size: " + std::to_string(env::pool_size()));
 	logger::log("env", "info", "login log: " + std::to_string(env::login_log_enabled()));
 	logger::log("env", "info", "http log: " + std::to_string(env::http_log_enabled()));
+	logger::log("env", "info", "max body size: " + std::to_string(env::max_body_size()));
+	logger::log("env", "info", "compress min size: " + std::to_string(env::compress_min_size()));
+	logger::log("env", "info", "file cache size: " + std::to_string(env::file_cache_size()));
+	logger::log("env", "info", "result cache size: " + std::to_string(env::result_cache_size()));
 	
 	std::string msg1; msg1.reserve(255);
 	std::string msg2; msg1.reserve(255);
 	msg1.append("Pod: " + pod_name).append(" PID: ").append(std::to_string(getpid())).append(" starting ").append(mse::SERVER_VERSION).append("-").append(std::to_string(CPP_BUILD_DATE));
-	msg2.append("hardware threads: ").append(std::to_string(std::thread::hardware_concurrency())).append(" GCC: ").append(__VERSION__);
+	msg2.append("hardware threads: ").append(std::to_string(std::thread::hardware_concurrency())).append(" GCC: ").append(__VERSION__).append(" scan kernel: ").append(scan::get_kernel_name());
 	logger::log("server", "info", msg1);
 	logger::log("server", "info", msg2);
 }
@@ -316,8 +366,12 @@ void start_server() noexcept
 		stops[i] = std::stop_source();
 		pool[i] = std::jthread(consumer, stops[i].get_token());
 	}
-	
-	start_epoll(port);
+	std::jthread listener(mse::listen);
+	//the port is opened only when the snapshot services have their first response
+	if (mse::load_snapshots(m_signal)) {
+		std::jthread snapshots(mse::refresh_snapshots);
+		start_epoll(port);
+	}
 	
 	//shutdown workers
 	for (auto s: stops) {
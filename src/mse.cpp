@@ -6,6 +6,10 @@ namespace mse
 	std::atomic<double> 	g_total_time{0};
 	std::atomic<int> 		g_active_threads{0};
 	std::atomic<size_t> 	g_connections{0};
+	std::atomic<long> 		g_compressed{0};
+	std::atomic<size_t> 	g_compress_in{0};
+	std::atomic<size_t> 	g_compress_out{0};
+	std::atomic<double> 	g_compress_time{0};
 
 	void update_connections(int n) noexcept
 	{
@@ -15,6 +19,9 @@ namespace mse
 	inline void fileservice(http::request& req);
 	inline void microservice(http::request& req);
 	inline std::string get_timestamp();
+	bool send_chunk(std::string& json) noexcept;
+	void batch(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params);
+	void send_mail(const config::microService& ms, const config::requestParameters& params, size_t rows = 1);
 	
 	const std::string LOGGER_SRC {"mse"};
 	const std::string m_startedOn {get_timestamp()};
@@ -153,6 +160,11 @@ namespace mse
 		std::string roles{""};
 	} thread_local t_user_info;
 
+	//request being processed by this thread, used by services that stream their response
+	thread_local http::request* t_request {nullptr};
+	//blob opened by downloadFile, microservice() sends it with sendfile instead of buffering it
+	thread_local int t_download {-1};
+
 	//security session support
 	inline bool sessionUpdate() noexcept 
 	{
@@ -178,46 +190,175 @@ namespace mse
 		}
 	}
 
+	//the service's statement with the values of the request
+	inline sql::query get_query(const config::prepared_template& st, const config::requestParameters& params) 
+	{
+		return {st.name, st.sql, params.get_values(st, t_user_info.userLogin), &st.placeholders};
+	}
+
+	//sql text of a service that could not be prepared, valid until the next call
+	thread_local std::string t_sql;
+
+	inline sql::query get_query(const config::microService& ms, const config::requestParameters& params) 
+	{
+		if (ms.statements.empty()) {
+			t_sql = params.sql(ms.sql_template, t_user_info.userLogin);
+			return t_sql;
+		}
+		return get_query(ms.statements.front(), params);
+	}
+
+	//db, statement and values of a query, equal keys produce the same resultset
+	thread_local std::string t_coalesce_key;
+
+	inline const std::string& get_coalesce_key(const std::string& db, const sql::query& q) 
+	{
+		t_coalesce_key.assign(db).push_back('\0');
+		t_coalesce_key.append(q.sql);
+		for (const char* v: q.values) {
+			t_coalesce_key.push_back(v ? '\0' : '\1');
+			if (v)
+				t_coalesce_key.append(v);
+		}
+		return t_coalesce_key;
+	}
+
 	//generic JSON microservices
 
 	//returns json straight from the database
-	void dbget_json(std::string& jsonBuffer, config::microService& ms) 
+	void dbget_json(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
+	{
+		const sql::query q {get_query(ms, params)};
+		if (ms.coalesce)
+			singleflight::run(get_coalesce_key(ms.db, q), jsonBuffer, [&](std::string& json) { sql::get_json_record(ms.db, json, q); });
+		else
+			sql::get_json_record(ms.db, jsonBuffer, q);
+	}
+
+	enum class export_format { json, csv, ndjson, msgpack };
+
+	//value of a query string parameter as it was sent, without decoding
+	inline std::string_view get_query_value(std::string_view target, std::string_view name) noexcept
+	{
+		const size_t start {scan::find_char(target, '?')};
+		if (start == std::string::npos)
+			return {};
+		const std::string_view qs {target.substr(start + 1)};
+		size_t pos {0};
+		while (pos < qs.size()) {
+			const size_t end {std::min(scan::find_char(qs, '&', pos), qs.size())};
+			const std::string_view item {qs.substr(pos, end - pos)};
+			if (item.size() > name.size() && item.starts_with(name) && item[name.size()] == '=')
+				return item.substr(name.size() + 1);
+			pos = end + 1;
+		}
+		return {};
+	}
+
+	//the _format query string parameter, or the Accept header if there is none, selects an export format for dbget,
+	//it is not taken from the input fields so a service can still declare one named format
+	inline export_format get_export_format(const http::request& req) noexcept
+	{
+		std::string_view format {get_query_value(req.queryString, "_format")};
+		if (format.empty()) {
+			const auto accept {req.get_header(http::header::accept)};
+			if (http::find_accepted(accept, "text/csv") == 1)
+				format = "csv";
+			else if (http::find_accepted(accept, "application/x-ndjson") == 1)
+				format = "ndjson";
+			else if (http::find_accepted(accept, "application/msgpack") == 1 || http::find_accepted(accept, "application/x-msgpack") == 1)
+				format = "msgpack";
+		}
+		if (format == "csv")
+			return export_format::csv;
+		if (format == "ndjson")
+			return export_format::ndjson;
+		if (format == "msgpack")
+			return export_format::msgpack;
+		return export_format::json;
+	}
+
+	//returns a single resultset, if streaming is enabled rows are sent as they are fetched,
+	//exports are always streamed, CSV is produced by COPY TO STDOUT and NDJSON from single-row mode,
+	//MessagePack is built from a single resultset fetched in binary format when the column types allow it
+	void dbget(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
+	{
+		switch (get_export_format(*t_request)) {
+			case export_format::csv:
+				t_user_info.contentType = "text/csv";
+				sql::copy_to(ms.db, jsonBuffer, params.sql(ms.sql_template, t_user_info.userLogin), "FORMAT csv, HEADER", send_chunk, http::chunk_size);
+				return;
+			case export_format::ndjson:
+				t_user_info.contentType = "application/x-ndjson";
+				sql::get_json_stream(ms.db, jsonBuffer, get_query(ms, params), send_chunk, http::chunk_size, sql::stream_format::ndjson);
+				return;
+			case export_format::msgpack:
+				t_user_info.contentType = "application/msgpack";
+				sql::get_msgpack(ms.db, jsonBuffer, get_query(ms, params));
+				return;
+			case export_format::json:
+				break;
+		}
+		if (ms.stream)
+			sql::get_json_stream(ms.db, jsonBuffer, get_query(ms, params), send_chunk, http::chunk_size);
+		else if (ms.coalesce) {
+			const sql::query q {get_query(ms, params)};
+			singleflight::run(get_coalesce_key(ms.db, q), jsonBuffer, [&](std::string& json) { sql::get_json(ms.db, json, q); });
+		} else
+			sql::get_json(ms.db, jsonBuffer, get_query(ms, params));
+	}
+
+	//query of a snapshot service, run by the refresh thread, requests are served from the last result
+	void snapshot(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
-		sql::get_json_record(ms.db, jsonBuffer, ms.reqParams.sql(ms.sql, t_user_info.userLogin));
+		sql::get_json(ms.db, jsonBuffer, get_query(ms, params));
 	}
 
-	//returns a single resultset
-	void dbget(std::string& jsonBuffer, config::microService& ms) 
+	//the request body goes to the COPY ... FROM STDIN of the service sql, CSV as it is, or NDJSON into a single json/jsonb column
+	//with "format csv, quote e'\x01', delimiter e'\x02'" so the lines are not parsed by COPY, large bodies are read from the
+	//spill file and never held in the heap
+	void dbcopy(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
-		sql::get_json(ms.db, jsonBuffer, ms.reqParams.sql(ms.sql, t_user_info.userLogin));
+		std::string sqlstate;
+		const long long rows {sql::copy_from(ms.db, params.sql(ms.sql_template, t_user_info.userLogin), t_request->get_body(), sqlstate)};
+		if (rows >= 0)
+			jsonBuffer.append("{\"status\": \"OK\", \"data\": {\"rows\": ").append(std::to_string(rows)).append("}}");
+		else if (sqlstate.size() == 5 && std::ranges::all_of(sqlstate, ::isalnum)) //class 22 is bad data, 23 a constraint violation
+			jsonBuffer.append("{\"status\": \"ERROR\",\"description\" : \"System error\",\"sqlstate\": \"").append(sqlstate).append("\"}");
+		else
+			jsonBuffer.append("{\"status\": \"ERROR\",\"description\" : \"System error\"}");
 	}
 
 	//returns multiple resultsets from a single query
-	void dbgetm(std::string& jsonBuffer, config::microService& ms) 
+	void dbgetm(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
-		sql::get_json(ms.db, jsonBuffer, ms.reqParams.sql(ms.sql, t_user_info.userLogin), ms.varNames);
+		std::vector<sql::query> queries;
+		queries.reserve(ms.statements.size());
+		for (const auto& st: ms.statements)
+			queries.push_back(get_query(st, params));
+		sql::get_json(ms.db, jsonBuffer, queries, ms.varNames);
 	}
 
 	//execute data modification query (insert, update, delete) with no resultset returned
-	void dbexec(std::string& jsonBuffer, config::microService& ms) 
+	void dbexec(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		constexpr char STATUS_OK[] = "{\"status\": \"OK\"}";
 		constexpr char STATUS_ERROR[] = "{\"status\": \"ERROR\",\"description\" : \"System error\"}";
 
-		if (sql::exec_sql(ms.db, ms.reqParams.sql(ms.sql, t_user_info.userLogin)))
+		if (sql::exec_sql(ms.db, get_query(ms, params)))
 			jsonBuffer.append(STATUS_OK);
 		else
 			jsonBuffer.append(STATUS_ERROR);
 	}
 
 	//login and create session
-	void login(std::string& jsonBuffer, config::microService& ms) 
+	void login(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		const std::string errInvalidLogin = R"({"status": "INVALID", "validation": {"id": "login", "description": "$err.invalidcredentials"}})";
 		const std::string loginOK = R"({"status": "OK", "data":[{"displayname":"$displayname"}]})";
 
-		std::string login{ ms.reqParams.get("login") };
-		std::string password{ ms.reqParams.get("password") };
+		std::string login{ params.get("login") };
+		std::string password{ params.get("password") };
 
 		if (login::bind( login, password)) {
 			sessionCreate(login, login::get_email(), login::get_roles());
@@ -232,7 +373,7 @@ namespace mse
 	}
 
 	//kill session
-	void logout(std::string& jsonBuffer, config::microService& ms) 
+	void logout(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		constexpr char STATUS_OK[] = "{\"status\": \"OK\"}";
 		session::remove(t_user_info.sessionID);
@@ -240,7 +381,7 @@ namespace mse
 	}
 
 	//return server status
-	void getServerInfo(std::string& jsonBuffer, config::microService& ms) 
+	void getServerInfo(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		std::array<char, 128> hostname{0};
 		gethostname(hostname.data(), hostname.size());
@@ -259,7 +400,7 @@ namespace mse
 	}
 
 	//return server metrics for Prometheus
-	void getMetrics(std::string& jsonBuffer, config::microService& ms) 
+	void getMetrics(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		t_user_info.contentType = "text/plain; version=0.0.4";
 
@@ -287,54 +428,114 @@ namespace mse
 		jsonBuffer.append("# TYPE cpp_avg_time counter\n");
 		jsonBuffer.append("cpp_avg_time{pod=\"").append(hostname.data()).append("\"} ").append(str2.data()).append("\n");
 
+		const double ratio{ ( g_compress_out > 0 ) ? static_cast<double>(g_compress_in) / g_compress_out : 0 };
+		const double avg_compress{ ( g_compressed > 0 ) ? g_compress_time * 1000 / g_compressed : 0 };
+		std::array<char, 64> str5{0}; std::to_chars(str5.data(), str5.data() + str5.size(), g_compressed);
+		std::array<char, 64> str6{0}; std::to_chars(str6.data(), str6.data() + str6.size(), ratio, std::chars_format::fixed, 2);
+		std::array<char, 64> str7{0}; std::to_chars(str7.data(), str7.data() + str7.size(), avg_compress, std::chars_format::fixed, 8);
+
+		jsonBuffer.append("# HELP cpp_compressed_total The number of compressed HTTP responses.\n");
+		jsonBuffer.append("# TYPE cpp_compressed_total counter\n");
+		jsonBuffer.append("cpp_compressed_total{pod=\"").append(hostname.data()).append("\"} ").append(str5.data()).append("\n");
+
+		jsonBuffer.append("# HELP cpp_compress_ratio Uncompressed bytes divided by compressed bytes.\n");
+		jsonBuffer.append("# TYPE cpp_compress_ratio gauge\n");
+		jsonBuffer.append("cpp_compress_ratio{pod=\"").append(hostname.data()).append("\"} ").append(str6.data()).append("\n");
+
+		jsonBuffer.append("# HELP cpp_compress_avg_time Average compression time per response in milliseconds.\n");
+		jsonBuffer.append("# TYPE cpp_compress_avg_time gauge\n");
+		jsonBuffer.append("cpp_compress_avg_time{pod=\"").append(hostname.data()).append("\"} ").append(str7.data()).append("\n");
+
+		const filecache::stats fc {filecache::get_stats()};
+		jsonBuffer.append("# HELP cpp_file_cache_hits_total Static file requests served from memory.\n");
+		jsonBuffer.append("# TYPE cpp_file_cache_hits_total counter\n");
+		jsonBuffer.append("cpp_file_cache_hits_total{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(fc.hits)).append("\n");
+
+		jsonBuffer.append("# HELP cpp_file_cache_misses_total Static file requests read from disk.\n");
+		jsonBuffer.append("# TYPE cpp_file_cache_misses_total counter\n");
+		jsonBuffer.append("cpp_file_cache_misses_total{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(fc.misses)).append("\n");
+
+		jsonBuffer.append("# HELP cpp_file_cache_bytes Memory used by the static file cache.\n");
+		jsonBuffer.append("# TYPE cpp_file_cache_bytes gauge\n");
+		jsonBuffer.append("cpp_file_cache_bytes{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(fc.bytes)).append("\n");
+
+		const resultcache::stats rc {resultcache::get_stats()};
+		jsonBuffer.append("# HELP cpp_result_cache_hits_total Microservice responses served from the result cache.\n");
+		jsonBuffer.append("# TYPE cpp_result_cache_hits_total counter\n");
+		jsonBuffer.append("cpp_result_cache_hits_total{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(rc.hits)).append("\n");
+
+		jsonBuffer.append("# HELP cpp_result_cache_misses_total Cacheable microservice requests that ran the service.\n");
+		jsonBuffer.append("# TYPE cpp_result_cache_misses_total counter\n");
+		jsonBuffer.append("cpp_result_cache_misses_total{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(rc.misses)).append("\n");
+
+		jsonBuffer.append("# HELP cpp_result_cache_evictions_total Results dropped from the result cache to stay within its memory budget.\n");
+		jsonBuffer.append("# TYPE cpp_result_cache_evictions_total counter\n");
+		jsonBuffer.append("cpp_result_cache_evictions_total{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(rc.evictions)).append("\n");
+
+		jsonBuffer.append("# HELP cpp_result_cache_invalidations_total Cache keys invalidated by services or database notifications.\n");
+		jsonBuffer.append("# TYPE cpp_result_cache_invalidations_total counter\n");
+		jsonBuffer.append("cpp_result_cache_invalidations_total{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(rc.invalidations)).append("\n");
+
+		jsonBuffer.append("# HELP cpp_result_cache_bytes Memory used by the result cache.\n");
+		jsonBuffer.append("# TYPE cpp_result_cache_bytes gauge\n");
+		jsonBuffer.append("cpp_result_cache_bytes{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(rc.bytes)).append("\n");
+
+		const singleflight::stats sf {singleflight::get_stats()};
+		jsonBuffer.append("# HELP cpp_coalesced_queries_total Queries executed by services with coalesce enabled.\n");
+		jsonBuffer.append("# TYPE cpp_coalesced_queries_total counter\n");
+		jsonBuffer.append("cpp_coalesced_queries_total{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(sf.calls)).append("\n");
+
+		jsonBuffer.append("# HELP cpp_coalesced_saved_total Database calls saved by reusing the response of an identical query in flight.\n");
+		jsonBuffer.append("# TYPE cpp_coalesced_saved_total counter\n");
+		jsonBuffer.append("cpp_coalesced_saved_total{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(sf.shared)).append("\n");
+
 		jsonBuffer.append("# HELP sessions Number of active logged-in users.\n");
 		jsonBuffer.append("# TYPE sessions counter\n");
 		jsonBuffer.append("sessions{pod=\"").append(hostname.data()).append("\"} ").append(std::to_string(session::get_total())).append("\n");
 	}
 
 	//active sessions in table cpp_session
-	void getSessionCount(std::string& jsonBuffer, config::microService& ms) 
+	void getSessionCount(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		jsonBuffer.append("{\"status\": \"OK\", \"data\":[{\"total\":").append(std::to_string(session::get_total())).append("}]}");
 	}
 
 	//download file from filesystem given its ID from DB 
-	void downloadFile(std::string& jsonBuffer, config::microService& ms) 
+	void downloadFile(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
-		auto rec = sql::get_record(ms.db, ms.reqParams.sql(ms.sql, t_user_info.userLogin));
+		auto rec = sql::get_record(ms.db, get_query(ms, params));
 		if ( rec.size() ) {
 			t_user_info.fileName = rec.at("filename");
 			t_user_info.contentType = rec.at("content_type");
 			std::string path{http::blob_path + rec.at("document")};
-			std::stringstream buffer;
-			{
-				std::ifstream file{path};
-				if (file.is_open()) {
-					buffer << file.rdbuf();
-					jsonBuffer.append(buffer.str());
-				} else {
-					logger::log(LOGGER_SRC, "error", "downloadFile -> cannot open file - user: " + t_user_info.userLogin 
-						+ " uri: " + path, true); 
-					std::string error{"Error downloading file: " + t_user_info.fileName + " with ID: " + rec.at("document")};
-					t_user_info.fileName = "error.txt";
-					t_user_info.contentType = "text/plain";
-					jsonBuffer.append(error);
-				}
+			const int fd {open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK)};
+			struct stat st;
+			if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+				t_download = fd;
+			} else {
+				if (fd != -1)
+					close(fd);
+				logger::log(LOGGER_SRC, "error", "downloadFile -> cannot open file - user: " + t_user_info.userLogin 
+					+ " uri: " + path, true); 
+				std::string error{"Error downloading file: " + t_user_info.fileName + " with ID: " + rec.at("document")};
+				t_user_info.fileName = "error.txt";
+				t_user_info.contentType = "text/plain";
+				jsonBuffer.append(error);
 			}
 		}
 	}
 
 	//delete blob's record from database and the blob's file from filesystem
-	void deleteFile(std::string& jsonBuffer, config::microService& ms) 
+	void deleteFile(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		constexpr char STATUS_OK[] = "{\"status\": \"OK\"}";
 		constexpr char STATUS_ERROR[] = "{\"status\": \"ERROR\",\"description\" : \"System error\"}";
 		
 		std::string sql{"select document from demo.blob where blob_id = $blob_id"};
-		auto rec = sql::get_record(ms.db, ms.reqParams.sql(sql, t_user_info.userLogin));
+		auto rec = sql::get_record(ms.db, params.sql(sql, t_user_info.userLogin));
 		if ( rec.size() ) {
 			std::string path{http::blob_path + rec.at("document")};
-			if ( sql::exec_sql(ms.db, ms.reqParams.sql(ms.sql, t_user_info.userLogin))) {
+			if ( sql::exec_sql(ms.db, get_query(ms, params))) {
 				std::remove( path.c_str() );
 				jsonBuffer.append( STATUS_OK );
 			} else {
@@ -346,7 +547,7 @@ namespace mse
 	}
 
 	//minimal service used to measure performance overhead of the dispatching mechanism
-	void get_version(std::string& jsonBuffer, config::microService& ms) 
+	void get_version(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		std::array<char, 128> hostname{0};
 		gethostname(hostname.data(), hostname.size());
@@ -355,7 +556,7 @@ namespace mse
 	}
 
 	//minimal service used to ping/keepalive all database connections held by this thread
-	void ping(std::string& jsonBuffer, config::microService& ms) 
+	void ping(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params) 
 	{
 		jsonBuffer.append("{\"status\": \"OK\"}");
 	}
@@ -363,7 +564,7 @@ namespace mse
 	//generic custom validators
 
 	//if the resultset is not empty then fail (jsonResp will contain something)
-	void db_nomatch(std::string &jsonResp, config::microService& ms) 
+	void db_nomatch(std::string &jsonResp, const config::microService& ms, config::requestParameters& params) 
 	{
 
 		const std::string STATUS_ERROR = R"(
@@ -376,13 +577,13 @@ namespace mse
 		}
 		)";
 
-		if (sql::has_rows(ms.db, ms.reqParams.sql(ms.validatorConfig.sql)))
+		if (sql::has_rows(ms.db, get_query(ms.validatorConfig.statement, params)))
 			jsonResp = replaceParam( STATUS_ERROR, { "$id", "$description" }, { ms.validatorConfig.id, ms.validatorConfig.description } );
 
 	}
 
 	//if the resultset is empty then fail (jsonResp will contain something)
-	void db_match(std::string &jsonResp, config::microService& ms) 
+	void db_match(std::string &jsonResp, const config::microService& ms, config::requestParameters& params) 
 	{
 
 		const std::string STATUS_ERROR = R"(
@@ -395,7 +596,7 @@ namespace mse
 		}
 		)";
 
-		if (!sql::has_rows(ms.db, ms.reqParams.sql(ms.validatorConfig.sql)))
+		if (!sql::has_rows(ms.db, get_query(ms.validatorConfig.statement, params)))
 			jsonResp = replaceParam( STATUS_ERROR, { "$id", "$description" }, { ms.validatorConfig.id, ms.validatorConfig.description } );
 
 	}
@@ -409,8 +610,14 @@ namespace mse
 			return dbget;
 		if (funcName=="dbgetm")
 			return dbgetm;
+		if (funcName=="snapshot")
+			return snapshot;
+		if (funcName=="batch")
+			return batch;
 		if (funcName=="dbexec")
 			return dbexec;
+		if (funcName=="dbcopy")
+			return dbcopy;
 		if (funcName=="login")
 			return login;
 		if (funcName=="logout")
@@ -466,9 +673,11 @@ namespace mse
 		}
 		)";
 
-		for (auto &p : params.list()) {
+		const std::vector<config::inputParam>& fields {params.list()};
+		for (size_t i = 0; i < fields.size(); i++) {
 
-			std::string value{""};
+			const config::inputParam& p {fields[i]};
+			std::string& value {params.value(i)};
 
 			if (auto ptr = httpReq.find(p.name); ptr != httpReq.end())
 				value = ptr->second;
@@ -505,15 +714,11 @@ namespace mse
 						}
 						break;
 
-					default: //string type
-						replaceString(value, "'", "''");
-						replaceString(value, "\\", "");
+					default: //string type, quoted when it is spliced into sql text
 						break;
 				}
 			}
 
-			p.value = value;
-
 		}
 
 		return;
@@ -529,31 +734,35 @@ namespace mse
 		return false;
 	}
 
-	inline std::string validateInputs(const std::string& path, const httpRequestParameters& httpReq, config::microService& ms) {
-
-		std::string validationErrors;
-
+	inline std::string check_roles(const std::string& path, const config::microService& ms) {
 		if ( ms.roleNames.size() && !t_user_info.userLogin.empty()) {
 			if (!is_user_in_role(ms.roleNames, t_user_info.roles)) {
 				logger::log("security", "warn", "access denied, insufficient security credentials - user: " + t_user_info.userLogin 
 					+ " uri: " +  path 
 					+ " user roles: " + t_user_info.roles 
 					+ " IP: " + t_user_info.ipAddr, true);
-				validationErrors = R"({"status": "INVALID", "validation": {"id": "_dialog_", "description": "$err.accessdenied"}})";
-				return validationErrors;
+				return R"({"status": "INVALID", "validation": {"id": "_dialog_", "description": "$err.accessdenied"}})";
 			}
 		}
+		return "";
+	}
+
+	inline std::string validateInputs(const std::string& path, const httpRequestParameters& httpReq, const config::microService& ms, config::requestParameters& params) {
 
-		if (ms.reqParams.list().empty())
+		std::string validationErrors {check_roles(path, ms)};
+		if (!validationErrors.empty())
+			return validationErrors;
+
+		if (ms.params.empty())
 			return "";
 
-		validateRequestParams(validationErrors, httpReq, ms.reqParams);
+		validateRequestParams(validationErrors, httpReq, params);
 
 		if ( !validationErrors.empty() ) {
 			return validationErrors;
 		} else {
 			if ( ms.customValidator ) {
-				ms.customValidator( validationErrors, ms );
+				ms.customValidator( validationErrors, ms, params );
 				if ( !validationErrors.empty() ) {
 					return validationErrors;
 				}
@@ -562,93 +771,398 @@ namespace mse
 		}
 	}
 
-	void send_mail(config::microService ms)
+	//the pipeline writes every row before reading any result on a blocking connection, more rows could fill
+	//the socket buffers of both sides and leave them waiting on each other
+	constexpr size_t max_bulk_rows {1000};
+
+	//a dbexec request whose body is a JSON array of rows, each one an object with the fields of the service
+	inline bool is_bulk(const config::microService& ms, http::request& req) noexcept
 	{
+		if (ms.func_service != "dbexec" || !req.get_header(http::header::content_type).starts_with("application/json"))
+			return false;
+		const std::string_view body {req.get_body()};
+		const size_t pos {body.find_first_not_of(" \t\r\n")};
+		return pos != std::string_view::npos && body[pos] == '[';
+	}
+
+	//every row is validated before any is executed, then all of them run in one transaction and one round trip,
+	//the response has the status of each row in the same order
+	void dbexec_bulk(std::string& jsonBuffer, const std::string& path, const config::microService& ms, std::string_view body)
+	{
+		const std::string INVALID_BULK {R"({"status": "INVALID", "validation": {"id": "_dialog_", "description": "$err.invalidbulk"}})"};
+		const std::string ROW_OK {R"({"status": "OK"})"};
+		const std::string ROW_ERROR {R"({"status": "ERROR", "description": "System error"})"};
+		const std::string ROW_ABORTED {R"({"status": "ABORTED"})"};
+
+		std::vector<std::string> items;
+		if (!http::parse_json_array(body, items) || items.empty() || items.size() > max_bulk_rows) {
+			jsonBuffer.append(INVALID_BULK);
+			return;
+		}
+
+		const size_t n {items.size()};
+		std::vector<config::requestParameters> rows(n); //not resized, queries point to their values
+		std::vector<std::string> status(n);
+		bool valid {true};
+		for (size_t i = 0; i < n; i++) {
+			httpRequestParameters input;
+			if (!http::parse_json_object(items[i], input)) {
+				jsonBuffer.append(INVALID_BULK);
+				return;
+			}
+			rows[i].bind(ms.params);
+			validateRequestParams(status[i], input, rows[i]);
+			if (status[i].empty() && ms.customValidator)
+				ms.customValidator(status[i], ms, rows[i]);
+			if (!status[i].empty())
+				valid = false;
+		}
+
+		std::string_view result {"INVALID"};
+		if (valid) {
+			//a service that was not prepared may have several statements, the pipeline takes one per query,
+			//so each one of every row becomes a query and owner keeps the row it belongs to
+			std::vector<sql::query> queries;
+			std::vector<std::string> texts;
+			std::vector<size_t> owner;
+			if (ms.statements.empty()) {
+				std::vector<std::string_view> split;
+				for (size_t i = 0; i < n; i++) {
+					const std::string text {rows[i].sql(ms.sql_template, t_user_info.userLogin)};
+					split.clear();
+					if (!config::split_statements(text, split))
+						split.assign(1, text);
+					for (const auto& s: split) {
+						texts.emplace_back(s);
+						owner.push_back(i);
+					}
+				}
+				queries.reserve(texts.size());
+				for (const auto& t: texts)
+					queries.emplace_back(t);
+			} else {
+				queries.reserve(n);
+				for (size_t i = 0; i < n; i++) {
+					queries.push_back(get_query(ms.statements.front(), rows[i]));
+					owner.push_back(i);
+				}
+			}
+			size_t failed {0};
+			const bool ok {sql::exec_pipeline(ms.db, queries, failed)};
+			const size_t failed_row {failed < owner.size() ? owner[failed] : n};
+			for (size_t i = 0; i < n; i++)
+				status[i] = ok ? ROW_OK : (i == failed_row ? ROW_ERROR : ROW_ABORTED);
+			result = ok ? "OK" : "ERROR";
+			//one audit record and one mail for the whole request, with the values of the first row and the row count
+			if (ok && ms.audit_enabled)
+				audit::save(path, t_user_info.userLogin, t_user_info.ipAddr, ms, rows.front(), n);
+			if (ok && ms.email_config.enabled)
+				send_mail(ms, rows.front(), n);
+		} else {
+			for (auto& s: status)
+				if (s.empty())
+					s = ROW_ABORTED;
+		}
+
+		jsonBuffer.append("{\"status\":\"").append(result).append("\",\"data\":[");
+		for (size_t i = 0; i < n; i++) {
+			if (i)
+				jsonBuffer.push_back(',');
+			jsonBuffer.append(status[i]);
+		}
+		jsonBuffer.append("]}");
+	}
+
+	void send_mail(const config::microService& ms, const config::requestParameters& params, size_t rows)
+	{
+		//the registry is shared by all threads, the background task gets its own copy with the params replaced
+		config::microService::email mail_config {ms.email_config};
+		if (rows > 1)
+			mail_config.subject.append(" (").append(std::to_string(rows)).append(" rows)");
+
 		//capture current thread request-id
 		std::string x_request_id {logger::get_request_id()}; 
 		
 		//load template
 		std::stringstream buffer;
 		{
-			std::ifstream file(ms.email_config.body_template);
+			std::ifstream file(mail_config.body_template);
 			if (file.is_open())
 				buffer << file.rdbuf();
 			else {
-				logger::log("email", "error", "email body template not found: " + ms.email_config.body_template, true);
+				logger::log("email", "error", "email body template not found: " + mail_config.body_template, true);
 				return;
 			}
 		}
 				
 		//get mail body with params replaced
-		std::string body{ms.reqParams.get_body(buffer.str(), t_user_info.userLogin)};
+		std::string body{params.get_body(buffer.str(), t_user_info.userLogin)};
 		
 		//replace input params if needed
-		if (ms.email_config.to == "$usermail")
-			ms.email_config.to = t_user_info.userMail;
+		if (mail_config.to == "$usermail")
+			mail_config.to = t_user_info.userMail;
 		
-		if (ms.email_config.to.starts_with("$"))
-			ms.email_config.to = ms.reqParams.get(ms.email_config.to.substr(1));
+		if (mail_config.to.starts_with("$"))
+			mail_config.to = params.get(mail_config.to.substr(1));
 
-		if (ms.email_config.cc == "$usermail")
-			ms.email_config.cc = t_user_info.userMail;
+		if (mail_config.cc == "$usermail")
+			mail_config.cc = t_user_info.userMail;
 		
-		if (ms.email_config.cc.starts_with("$"))
-			ms.email_config.cc = ms.reqParams.get(ms.email_config.cc.substr(1));
+		if (mail_config.cc.starts_with("$"))
+			mail_config.cc = params.get(mail_config.cc.substr(1));
 		
-		if (!ms.email_config.attachment.empty())
-			ms.email_config.attachment = ms.reqParams.get_body(ms.email_config.attachment, t_user_info.userLogin);		
+		if (!mail_config.attachment.empty())
+			mail_config.attachment = params.get_body(mail_config.attachment, t_user_info.userLogin);		
 
-		if (ms.email_config.attachment_filename.starts_with("$"))
-			ms.email_config.attachment_filename = ms.reqParams.get(ms.email_config.attachment_filename.substr(1));
+		if (mail_config.attachment_filename.starts_with("$"))
+			mail_config.attachment_filename = params.get(mail_config.attachment_filename.substr(1));
 
 		//send mail using background thread
-		std::jthread task ( [ms, body, x_request_id]() {
+		std::jthread task ( [mail_config, body, x_request_id]() {
 			smtp::mail m(env::get_str("CPP_MAIL_SERVER"), env::get_str("CPP_MAIL_USER"), env::get_str("CPP_MAIL_PWD"));
 			m.x_request_id = x_request_id; //for logging-tracing purposes
-			m.to = ms.email_config.to;
-			m.cc = ms.email_config.cc;
-			m.subject = ms.email_config.subject;
+			m.to = mail_config.to;
+			m.cc = mail_config.cc;
+			m.subject = mail_config.subject;
 			m.body = body;
-			if (!ms.email_config.attachment.empty()) {
-				if (!ms.email_config.attachment_filename.empty())
-					m.add_attachment(ms.email_config.attachment, ms.email_config.attachment_filename);
+			if (!mail_config.attachment.empty()) {
+				if (!mail_config.attachment_filename.empty())
+					m.add_attachment(mail_config.attachment, mail_config.attachment_filename);
 				else
-					m.add_attachment(ms.email_config.attachment);
+					m.add_attachment(mail_config.attachment);
 			}
 			m.send();
 		} );
 		task.detach();
 	}
 	
+	//response of a snapshot service, rebuilt by the refresh thread and published with an atomic swap
+	struct snapshot_response
+	{
+		std::string body;
+		std::string gzip; //empty if the service disables compression or the body is below CPP_COMPRESS_MIN_SIZE
+		std::string etag; //empty if the service does not use it
+	};
+	using snapshot_ptr = std::shared_ptr<const snapshot_response>;
+
+	//services of config.json with their functions resolved and the route table compiled from their URIs,
+	//the route id is the index in services
+	struct service_registry 
+	{
+		std::vector<config::microService> services;
+		router::table routes;
+		std::vector<int> snapshot_ids; //services with function "snapshot"
+		//indexed like services, the only part of the registry written after it is built
+		mutable std::vector<std::atomic<snapshot_ptr>> snapshots;
+	};
+
+	//shared read-only by all the worker threads, it is replaced as a whole and a request
+	//keeps the version it started with until it completes
+	std::atomic<std::shared_ptr<const service_registry>> g_registry;
+	std::once_flag g_registry_once;
+
+	std::shared_ptr<const service_registry> load_registry()
+	{
+		auto registry {std::make_shared<service_registry>()};
+		std::vector<std::string> uris;
+		for (const auto& [uri, ms]: config::get_config_map()) 
+		{
+			config::microService& m {registry->services.emplace_back(ms)};
+			m.serviceFunction = getFunctionPointer(m.func_service);
+			if (!m.func_validator.empty())
+				m.customValidator = getValidatorFunctionPointer(m.func_validator);
+			if (m.func_service == "snapshot")
+				registry->snapshot_ids.push_back(registry->services.size() - 1);
+			uris.push_back(uri);
+		}
+		registry->routes = router::table(uris);
+		registry->snapshots = std::vector<std::atomic<snapshot_ptr>>(registry->services.size());
+		return registry;
+	}
+
+	inline void init_registry()
+	{
+		std::call_once(g_registry_once, [] { g_registry.store(load_registry(), std::memory_order_release); });
+	}
+
+	inline bool is_ok(std::string_view json) noexcept
+	{
+		return json.starts_with("{\"status\":\"OK\"") || json.starts_with("{\"status\": \"OK\"");
+	}
+
+	constexpr size_t max_batch_size {100};
+
+	//batch ids are written to the response as they are, they cannot need escaping
+	inline bool is_valid_batch_id(std::string_view id) noexcept
+	{
+		return !id.empty() && id.size() <= 64 && std::ranges::all_of(id, [](char c) { 
+			return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' || c == '.'; });
+	}
+
+	//the body is [{"id": "a", "uri": "/ms/...", "params": {...}}, ...] and the response {"status":"OK","data":{"a": <response of the entry>, ...}},
+	//each entry is checked like a request to its uri, then the dbget and dbget_json entries of each database run in one pipeline
+	void batch(std::string& jsonBuffer, const config::microService& ms, config::requestParameters& params)
+	{
+		const std::string INVALID_BATCH {R"({"status": "INVALID", "validation": {"id": "_dialog_", "description": "$err.invalidbatch"}})"};
+		const std::string ENTRY_ERROR {R"({"status": "ERROR", "description": "Invalid batch entry"})"};
+		const std::string LOGIN_REQUIRED {R"({"status": "ERROR", "description": "Please login with valid credentials"})"};
+
+		struct entry {
+			std::string id;
+			std::string uri;
+			int route {-1};
+			config::requestParameters params;
+			std::string response;
+		};
+
+		std::vector<std::string> items;
+		if (!http::parse_json_array(t_request->get_body(), items) || items.empty() || items.size() > max_batch_size) {
+			jsonBuffer.append(INVALID_BATCH);
+			return;
+		}
+
+		const auto registry {g_registry.load(std::memory_order_acquire)};
+		std::vector<entry> entries(items.size()); //not resized, queries point to the params of each entry
+		bool logged_in {!t_user_info.userLogin.empty()};
+		bool session_checked {logged_in};
+		for (size_t i = 0; i < items.size(); i++) {
+			entry& e {entries[i]};
+			httpRequestParameters fields;
+			httpRequestParameters input;
+			if (!http::parse_json_object(items[i], fields)) {
+				jsonBuffer.append(INVALID_BATCH);
+				return;
+			}
+			e.id = fields.contains("id") ? fields["id"] : std::to_string(i);
+			if (!is_valid_batch_id(e.id) || std::any_of(entries.begin(), entries.begin() + i, [&e](const entry& x) { return x.id == e.id; })) {
+				jsonBuffer.append(INVALID_BATCH);
+				return;
+			}
+			e.uri = fields["uri"];
+			if (const auto& p {fields["params"]}; !p.empty() && !http::parse_json_object(p, input)) {
+				e.response = ENTRY_ERROR;
+				continue;
+			}
+			e.route = registry->routes.find(e.uri, input);
+			if (e.route == -1) {
+				e.response = ENTRY_ERROR;
+				continue;
+			}
+			const config::microService& svc {registry->services[e.route]};
+			const std::string& f {svc.func_service};
+			if (svc.stream || (f != "dbget" && f != "dbget_json" && f != "dbgetm" && f != "snapshot")) {
+				e.response = ENTRY_ERROR;
+				continue;
+			}
+			if (svc.secure && !session_checked) {
+				logged_in = sessionUpdate();
+				session_checked = true;
+			}
+			if (svc.secure && !logged_in) {
+				e.response = LOGIN_REQUIRED;
+				continue;
+			}
+			e.params.bind(svc.params);
+			e.response = validateInputs(e.uri, input, svc, e.params);
+		}
+
+		//pipelines by database
+		std::unordered_map<std::string, std::vector<size_t>> pipelines;
+		for (size_t i = 0; i < entries.size(); i++) {
+			entry& e {entries[i]};
+			if (!e.response.empty())
+				continue;
+			const config::microService& svc {registry->services[e.route]};
+			if (svc.refresh_ms) {
+				if (const auto snap {registry->snapshots[e.route].load(std::memory_order_acquire)})
+					e.response = snap->body;
+				else
+					e.response = ENTRY_ERROR;
+			} else if (svc.func_service == "dbgetm" || svc.statements.empty()) //the pipeline takes a single statement per query
+				svc.serviceFunction(e.response, svc, e.params);
+			else
+				pipelines[svc.db].push_back(i);
+		}
+		for (const auto& [db, ids]: pipelines) {
+			std::vector<sql::query> queries;
+			std::vector<bool> records;
+			std::vector<std::string> results;
+			queries.reserve(ids.size());
+			for (const size_t i: ids) {
+				entry& e {entries[i]};
+				const config::microService& svc {registry->services[e.route]};
+				queries.push_back(get_query(svc.statements.front(), e.params));
+				records.push_back(svc.func_service == "dbget_json");
+			}
+			sql::get_json_pipeline(db, queries, records, results);
+			for (size_t j = 0; j < ids.size(); j++)
+				entries[ids[j]].response = std::move(results[j]);
+		}
+
+		jsonBuffer.append("{\"status\":\"OK\",\"data\":{");
+		for (size_t i = 0; i < entries.size(); i++) {
+			const entry& e {entries[i]};
+			if (i)
+				jsonBuffer.push_back(',');
+			jsonBuffer.append("\"").append(e.id).append("\":").append(e.response);
+			if (e.route != -1 && registry->services[e.route].audit_enabled && is_ok(e.response))
+				audit::save(e.uri, t_user_info.userLogin, t_user_info.ipAddr, registry->services[e.route], e.params);
+		}
+		jsonBuffer.append("}}");
+	}
+
 	struct service_engine 
 	{
 	  public:
 		service_engine() {
 			m_json_buffer.reserve(32767);
-			m_service_map = config::get_config_map();
-			for (auto& m: m_service_map) 
-			{
-				m.second.serviceFunction = getFunctionPointer(m.second.func_service);
-				if (!m.second.func_validator.empty())
-					m.second.customValidator = getValidatorFunctionPointer(m.second.func_validator);
-			}
 		}
 
 		inline std::string& run(http::request& req) 
 		{
-			if (auto m = m_service_map.find( req.path ); m != m_service_map.end() ) {
-				if ( m->second.secure ) {
+			m_service = nullptr;
+			m_snapshot.reset();
+			m_etag.clear();
+			m_registry = g_registry.load(std::memory_order_acquire);
+			if (const int id {m_registry->routes.find( req.path, req.params )}; id != -1 ) {
+				const config::microService& ms {m_registry->services[id]};
+				m_service = &ms;
+				if ( ms.secure ) {
 					if ( !sessionUpdate() )
 						throw LoginRequiredException();
 				}
+				m_params.bind(ms.params);
 				m_json_buffer.clear();
-				m_json_buffer.append( validateInputs( req.path, req.params, m->second ) );
+				if ( is_bulk(ms, req) ) {
+					m_json_buffer.append( check_roles( std::string(req.path), ms ) );
+					if ( m_json_buffer.empty() ) {
+						dbexec_bulk( m_json_buffer, std::string(req.path), ms, req.get_body() );
+						if ( is_ok(m_json_buffer) )
+							for (const auto& key: ms.invalidates)
+								resultcache::invalidate(key);
+					}
+					return m_json_buffer;
+				}
+				m_json_buffer.append( validateInputs( std::string(req.path), req.params, ms, m_params ) );
 				if (m_json_buffer.empty() ) {
-					m->second.serviceFunction( m_json_buffer, m->second );
-					if ( m->second.audit_enabled )
-						audit::save(req.path, t_user_info.userLogin, req.remote_ip, m->second);
-					if (m->second.email_config.enabled)
-						send_mail(m->second);
+					if ( ms.refresh_ms ) {
+						m_snapshot = m_registry->snapshots[id].load(std::memory_order_acquire);
+						if ( !m_snapshot )
+							throw std::runtime_error("snapshot not loaded yet");
+						m_etag = m_snapshot->etag;
+					} else if ( !get_cached(req, ms) ) {
+						ms.serviceFunction( m_json_buffer, ms, m_params );
+						set_cached(ms);
+						if ( !ms.invalidates.empty() && is_ok(m_json_buffer) )
+							for (const auto& key: ms.invalidates)
+								resultcache::invalidate(key);
+					}
+					if ( ms.etag && !ms.stream && !m_snapshot )
+						m_etag = http::get_etag(m_json_buffer);
+					if ( ms.audit_enabled )
+						audit::save(std::string(req.path), t_user_info.userLogin, req.remote_ip, ms, m_params);
+					if (ms.email_config.enabled)
+						send_mail(ms, m_params);
 				}
 				return m_json_buffer;
 			} else {
@@ -656,94 +1170,403 @@ namespace mse
 			}
 		}
 
-		void init() {}
+		//the key is the path, the validated input values and the user if the service caches per user
+		inline bool get_cached(const http::request& req, const config::microService& ms)
+		{
+			m_cache_key.clear();
+			if ( ms.cache.ttl_ms == 0 || ms.stream || get_export_format(req) != export_format::json )
+				return false;
+			m_cache_key.assign(req.path);
+			for (size_t i = 0; i < ms.params.size(); i++)
+				m_cache_key.append(1, '\0').append(m_params.value(i));
+			if ( ms.cache.per_user )
+				m_cache_key.append(1, '\0').append(t_user_info.userLogin);
+			if (const auto e {resultcache::find(m_cache_key)}) {
+				m_json_buffer.append(e->body);
+				return true;
+			}
+			m_cache_versions = resultcache::get_versions(ms.cache.keys);
+			return false;
+		}
+
+		//only successful JSON responses are cached, the key is empty if get_cached() did not look it up
+		inline void set_cached(const config::microService& ms)
+		{
+			if ( m_cache_key.empty() || !is_ok(m_json_buffer) )
+				return;
+			resultcache::insert(m_cache_key, m_json_buffer, std::chrono::milliseconds(ms.cache.ttl_ms), std::move(m_cache_versions));
+		}
+
+		//the first thread to start builds the registry
+		void init() 
+		{
+			init_registry();
+		}
+
+		//the service run by the last call to run() allows compression
+		bool compress_enabled() const noexcept
+		{
+			return m_service != nullptr && m_service->compress;
+		}
+
+		//dbget picks its format from the Accept header, compressed responses depend on Accept-Encoding
+		std::string_view vary() const noexcept
+		{
+			if (m_service == nullptr)
+				return "";
+			if (m_service->func_service == "dbget")
+				return m_service->compress ? "Accept, Accept-Encoding" : "Accept";
+			return m_service->compress ? "Accept-Encoding" : "";
+		}
+
+		//weak ETag of the response of the last call to run(), empty if the service does not use it
+		const std::string& etag() const noexcept
+		{
+			return m_etag;
+		}
+
+		//response of the last call to run() if the service is a snapshot, the body returned by run() is empty then
+		const snapshot_ptr& snapshot() const noexcept
+		{
+			return m_snapshot;
+		}
 
 	  private:
-		std::unordered_map<std::string, config::microService> m_service_map;
+		std::shared_ptr<const service_registry> m_registry;
+		const config::microService* m_service {nullptr};
+		config::requestParameters m_params; //values of the current request, reused by every request of this thread
 		std::string m_json_buffer;
+		std::string m_cache_key;
+		resultcache::tag_versions m_cache_versions;
+		snapshot_ptr m_snapshot;
+		std::string m_etag;
 		
 	}; 
 	thread_local service_engine t_service;
 
+	thread_local http::content_encoding t_encoding {http::content_encoding::identity};
+	thread_local std::string t_compressed;
+
+	//compressed data is appended to t_compressed
+	inline bool compress_body(std::string_view data, bool start, bool finish) noexcept
+	{
+		const auto t0 {std::chrono::high_resolution_clock::now()};
+		const size_t offset {t_compressed.size()};
+		if (!http::compress(t_encoding, data, t_compressed, start, finish))
+			return false;
+		const std::chrono::duration<double> elapsed {std::chrono::high_resolution_clock::now() - t0};
+		g_compress_time += elapsed.count();
+		g_compress_in += data.size();
+		g_compress_out += t_compressed.size() - offset;
+		if (start)
+			++g_compressed;
+		return true;
+	}
+
+	//encoding for the response of the current service, if the client accepts one
+	inline void set_encoding(const http::request& req, std::string_view content_type, size_t size) noexcept
+	{
+		t_encoding = http::content_encoding::identity;
+		if (t_service.compress_enabled() && size >= env::compress_min_size() && http::is_compressible(content_type))
+			t_encoding = http::get_content_encoding(req.get_header(http::header::accept_encoding));
+	}
+
 	inline void set_trace_headers(const http::request& req, http::response_stream& res) noexcept
 	{
-		if (req.headers.contains("x-request-id"))
-			res << "x-request-id: " << req.get_header("x-request-id") << "\r\n";
+		if (auto id = req.get_header(http::header::x_request_id); !id.empty())
+			res << "x-request-id: " << id << "\r\n";
+	}
+
+	//status line and constant headers of each kind of response, built once at startup,
+	//only Date, Origin, x-request-id and the content headers are spliced in per response
+	const std::string common_headers {
+		"Access-Control-Allow-Credentials: true\r\n"
+		"Strict-Transport-Security: max-age=31536000; includeSubDomains; preload;\r\n"
+		"X-Frame-Options: SAMEORIGIN\r\n"
+	};
+	const std::string keep_alive {"Keep-Alive: timeout=5, max=200\r\n"};
+	const std::string ok_headers {"HTTP/1.1 200 OK\r\n" + keep_alive + common_headers + "Access-Control-Expose-Headers: content-disposition\r\n"};
+	const std::string chunked_headers {ok_headers + "Transfer-Encoding: chunked\r\n"};
+	const std::string not_modified_headers {"HTTP/1.1 304 Not Modified\r\n" + keep_alive + common_headers};
+	const std::string partial_headers {"HTTP/1.1 206 Partial Content\r\n" + keep_alive + common_headers + "Access-Control-Expose-Headers: content-disposition\r\n"};
+	const std::string not_satisfiable_headers {"HTTP/1.1 416 Range Not Satisfiable\r\n" + keep_alive + common_headers};
+	const std::string static_cache_control {"Cache-Control: max-age=3600\r\n"};
+	const std::string byteranges_boundary {"cppserver_byteranges_5e1f09c3a7d2"};
+
+	//complete text/plain response, except for the spliced headers
+	struct canned_response 
+	{
+		std::string headers;
+		std::string body;
+		canned_response(const std::string& status, const std::string& msg, const std::string& extra_headers = keep_alive):
+			headers {"HTTP/1.1 " + status + "\r\n" 
+				+ "Content-Length: " + std::to_string(msg.size()) + "\r\n"
+				+ "Content-Type: text/plain\r\n"
+				+ extra_headers + common_headers},
+			body {msg}
+		{ }
+	};
+	const canned_response bad_request {"400 Bad request", "Bad request"};
+	const canned_response unauthorized {"401 Unauthorized", "Please login with valid credentials"};
+	const canned_response not_found {"404 Not found", "Resource not found"};
+	const canned_response moved {"301 Moved permanently", "301 Moved permanently"};
+	const canned_response too_large {"413 Payload too large", "Payload too large", "Connection: close\r\n"};
+
+	inline void send_headers(const http::request& req, http::response_stream& res, const std::string& headers) noexcept
+	{
+		res << headers
+			<< "Date: " << http::get_response_date() << "\r\n"
+			<< "Access-Control-Allow-Origin: " << req.origin << "\r\n";
+		set_trace_headers(req, res);
+	}
+
+	inline void send_canned(http::request& req, const canned_response& r) noexcept
+	{
+		send_headers(req, req.response, r.headers);
+		req.response << "\r\n" << r.body;
+	}
+
+	//the first call sends the headers, every call sends the buffer as one chunk and clears it
+	bool send_chunk(std::string& json) noexcept
+	{
+		http::request& req = *t_request;
+		http::response_stream& res = req.response;
+		bool start {false};
+		if (!res.is_chunked()) {
+			const std::string_view content_type {(t_user_info.contentType.empty()) ? "application/json" : t_user_info.contentType};
+			//the total size is not known, stream responses are compressed regardless of CPP_COMPRESS_MIN_SIZE
+			set_encoding(req, content_type, env::compress_min_size());
+			send_headers(req, res, chunked_headers);
+			res << "Content-Type: " << content_type << "\r\n";
+			if (const std::string_view vary {t_service.vary()}; !vary.empty())
+				res << "Vary: " << vary << "\r\n";
+			if (t_encoding != http::content_encoding::identity)
+				res << "Content-Encoding: " << http::get_encoding_name(t_encoding) << "\r\n";
+			res << "\r\n";
+			res.begin_chunked(req.fd);
+			start = true;
+		}
+		bool result {true};
+		if (t_encoding != http::content_encoding::identity) {
+			t_compressed.clear();
+			result = compress_body(json, start, false) && res.write_chunk(t_compressed);
+		} else
+			result = res.write_chunk(json);
+		json.clear();
+		return result;
+	}
+
+	//the body is not copied, the response keeps the snapshot alive until it is sent
+	inline void send_snapshot(http::request& req, const snapshot_ptr& snap, std::string_view etag) noexcept
+	{
+		http::response_stream& res = req.response;
+		const bool gzip {!snap->gzip.empty() 
+			&& http::get_content_encoding(req.get_header(http::header::accept_encoding)) == http::content_encoding::gzip};
+		const std::string_view body {gzip ? snap->gzip : snap->body};
+		send_headers(req, res, ok_headers);
+		res	<< "Content-Length: " << body.size() << "\r\n" 
+			<< "Content-Type: application/json\r\n";
+		if (const std::string_view vary {t_service.vary()}; !vary.empty())
+			res << "Vary: " << vary << "\r\n";
+		if (gzip)
+			res << "Content-Encoding: gzip\r\n";
+		if (!etag.empty())
+			res << "ETag: " << etag << "\r\n";
+		res << "\r\n";
+		res.attach(snap, body);
 	}
 
 	inline void send400(http::request& req) 
 	{
 		logger::log(LOGGER_SRC, "error", "bad http request - IP: " + req.remote_ip + " error: " + req.errmsg, true);
-		std::string msg {"Bad request"};
-		http::response_stream& res = req.response;
-		res << "HTTP/1.1 400 Bad request" << "\r\n"
-			<< "Content-Length: " << msg.size() << "\r\n"
-			<< "Content-Type: " << "text/plain" << "\r\n" 
-			<< "Keep-Alive: timeout=5, max=200" << "\r\n"
-			<< "Date: " << http::get_response_date() << "\r\n"
-			<< "Access-Control-Allow-Origin: " << req.origin << "\r\n"
-			<< "Access-Control-Allow-Credentials: true" << "\r\n"
-			<< "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload;" << "\r\n"
-			<< "X-Frame-Options: SAMEORIGIN" << "\r\n"
-			<< "\r\n"					
-			<< msg;
+		send_canned(req, bad_request);
+	}
+
+	inline void send413(http::request& req) 
+	{
+		logger::log(LOGGER_SRC, "error", "request body too large - IP: " + req.remote_ip + " error: " + req.errmsg, true);
+		send_canned(req, too_large);
 	}
 
 	inline void send401(http::request& req) 
 	{
-		std::string msg {"Please login with valid credentials"};
+		send_canned(req, unauthorized);
+	}
+
+	inline void send404(http::request& req) 
+	{
+		send_canned(req, not_found);
+	}
+
+	inline void sendRedirect(http::request& req, const std::string& newPath) 
+	{
+		send_headers(req, req.response, moved.headers);
+		req.response << "Location: " << newPath << "\r\n"
+			<< "\r\n" << moved.body;
+	}
+
+	//static file or blob being sent, the bytes come from the cache entry or from fd with sendfile
+	struct file_source {
+		filecache::entry_ptr cached;
+		int fd {-1}; //the response closes it once sent
+		size_t size {0};
+		std::time_t mtime {0};
+		std::string_view content_type;
+		std::string_view etag; //empty if not known
+		std::string_view last_modified;
+		std::string_view cache_control;
+	};
+
+	inline file_source cached_source(const filecache::entry_ptr& file) noexcept
+	{
+		return {file, -1, file->body.size(), file->mtime, file->content_type, file->etag, file->last_modified, static_cache_control};
+	}
+
+	//If-None-Match, or If-Modified-Since if there is no If-None-Match
+	inline bool is_not_modified(const http::request& req, const file_source& file) noexcept
+	{
+		if (const auto etags {req.get_header(http::header::if_none_match)}; !etags.empty())
+			return !file.etag.empty() && http::etag_matches(etags, file.etag);
+		if (const auto since {req.get_header(http::header::if_modified_since)}; !since.empty()) {
+			const std::time_t t {http::parse_http_date(since)};
+			return t != -1 && file.mtime <= t;
+		}
+		return false;
+	}
+
+	//a Range is applied only if If-Range still matches, a weak ETag never does (strong comparison)
+	inline bool if_range_matches(const http::request& req, const file_source& file) noexcept
+	{
+		const auto value {req.get_header(http::header::if_range)};
+		if (value.empty())
+			return true;
+		if (value.starts_with('"') || value.starts_with("W/"))
+			return !file.etag.empty() && !file.etag.starts_with("W/") && value == file.etag;
+		return http::parse_http_date(value) == file.mtime;
+	}
+
+	inline void attach_range(http::response_stream& res, const file_source& file, size_t first, size_t length) noexcept
+	{
+		if (file.cached)
+			res.attach(file.cached, std::string_view(file.cached->body).substr(first, length));
+		else
+			res.attach_file(first, length);
+	}
+
+	inline void send_validators(http::response_stream& res, const file_source& file) noexcept
+	{
+		res << file.cache_control;
+		if (!file.etag.empty())
+			res << "ETag: " << file.etag << "\r\n";
+		res << "Last-Modified: " << file.last_modified << "\r\n";
+		if (file.cached && !file.cached->gzip.empty())
+			res << "Vary: Accept-Encoding\r\n";
+	}
+
+	//206 with one range, multipart/byteranges with several, 416 if none can be satisfied
+	void send_ranges(http::request& req, const file_source& file, const std::vector<http::byte_range>& ranges, std::string_view extra_headers) noexcept
+	{
 		http::response_stream& res = req.response;
-		res << "HTTP/1.1 401 Unauthorized" << "\r\n"
-			<< "Content-Length: " << msg.size() << "\r\n"
-			<< "Content-Type: " << "text/plain" << "\r\n" 
-			<< "Keep-Alive: timeout=5, max=200" << "\r\n"
-			<< "Date: " << http::get_response_date() << "\r\n"
-			<< "Access-Control-Allow-Origin: " << req.origin << "\r\n"
-			<< "Access-Control-Allow-Credentials: true" << "\r\n"
-			<< "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload;" << "\r\n"
-			<< "X-Frame-Options: SAMEORIGIN" << "\r\n"
-			<< "\r\n"					
-			<< msg;
+		if (ranges.empty()) {
+			send_headers(req, res, not_satisfiable_headers);
+			res << "Content-Range: bytes */" << file.size << "\r\n"
+				<< "Content-Length: 0\r\n"
+				<< "\r\n";
+			return;
+		}
+		send_headers(req, res, partial_headers);
+		send_validators(res, file);
+		res << extra_headers;
+		if (ranges.size() == 1) {
+			const http::byte_range& r {ranges.front()};
+			res << "Content-Length: " << r.length << "\r\n"
+				<< "Content-Type: " << file.content_type << "\r\n"
+				<< "Content-Range: bytes " << r.first << "-" << r.first + r.length - 1 << "/" << file.size << "\r\n"
+				<< "\r\n";
+			attach_range(res, file, r.first, r.length);
+			return;
+		}
+		//the part headers are built first to compute the Content-Length
+		thread_local std::vector<std::string> parts;
+		parts.resize(ranges.size());
+		const std::string last {"\r\n--" + byteranges_boundary + "--\r\n"};
+		size_t length {last.size()};
+		for (size_t i = 0; i < ranges.size(); i++) {
+			const http::byte_range& r {ranges[i]};
+			parts[i].assign("\r\n--").append(byteranges_boundary)
+				.append("\r\nContent-Type: ").append(file.content_type)
+				.append("\r\nContent-Range: bytes ").append(std::to_string(r.first)).append("-")
+				.append(std::to_string(r.first + r.length - 1)).append("/").append(std::to_string(file.size))
+				.append("\r\n\r\n");
+			length += parts[i].size() + r.length;
+		}
+		res << "Content-Length: " << length << "\r\n"
+			<< "Content-Type: multipart/byteranges; boundary=" << byteranges_boundary << "\r\n"
+			<< "\r\n";
+		for (size_t i = 0; i < ranges.size(); i++) {
+			res << parts[i];
+			attach_range(res, file, ranges[i].first, ranges[i].length);
+		}
+		res << last;
 	}
 
-	inline void send404(http::request& req) {
-		
-		std::string msg {"Resource not found"};
+	//the body is never copied into the response, it is sent from the cache entry or the file descriptor
+	void send_file(http::request& req, const file_source& file, std::string_view extra_headers = "") noexcept
+	{
 		http::response_stream& res = req.response;
-		res << "HTTP/1.1 404 Not found" << "\r\n"
-			<< "Content-Length: " << msg.size() << "\r\n"
-			<< "Content-Type: " << "text/plain" << "\r\n" 
-			<< "Keep-Alive: timeout=5, max=200" << "\r\n"
-			<< "Date: " << http::get_response_date() << "\r\n"
-			<< "Access-Control-Allow-Origin: " << req.origin << "\r\n"
-			<< "Access-Control-Allow-Credentials: true" << "\r\n"
-			<< "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload;" << "\r\n"
-			<< "X-Frame-Options: SAMEORIGIN" << "\r\n"
-			<< "\r\n"					
-			<< msg;
+		if (file.fd != -1)
+			res.set_file(file.fd);
+
+		if (is_not_modified(req, file)) {
+			send_headers(req, res, not_modified_headers);
+			send_validators(res, file);
+			res << "\r\n";
+			return;
+		}
 
+		if (const auto range {req.get_header(http::header::range)}; !range.empty() && if_range_matches(req, file)) {
+			thread_local std::vector<http::byte_range> ranges;
+			if (http::parse_range(range, file.size, ranges)) {
+				send_ranges(req, file, ranges, extra_headers);
+				return;
+			}
+		}
+
+		send_headers(req, res, ok_headers);
+		res << file.cache_control;
+		if (file.cached) {
+			const bool gzip {!file.cached->gzip.empty() 
+				&& http::get_content_encoding(req.get_header(http::header::accept_encoding)) == http::content_encoding::gzip};
+			res << (gzip ? file.cached->gzip_headers : file.cached->headers) << extra_headers << "\r\n";
+			res.attach(file.cached, gzip ? file.cached->gzip : file.cached->body);
+			return;
+		}
+		res << "Content-Length: " << file.size << "\r\n"
+			<< "Content-Type: " << file.content_type << "\r\n"
+			<< "Last-Modified: " << file.last_modified << "\r\n"
+			<< "Accept-Ranges: bytes\r\n"
+			<< extra_headers << "\r\n";
+		res.attach_file(0, file.size);
 	}
 
-	inline void sendRedirect(http::request& req, std::string newPath) {
-		std::string msg {"301 Moved permanently"};
-		http::response_stream& res = req.response;
-		res << "HTTP/1.1 301 Moved permanently" << "\r\n"
-			<< "Location: " << newPath << "\r\n" 
-			<< "Keep-Alive: timeout=5, max=200" << "\r\n"
-			<< "Content-Length: " << msg.size() << "\r\n"
-			<< "Content-Type: " << "text/plain" << "\r\n" 
-			<< "Date: " << http::get_response_date() << "\r\n"
-			<< "Access-Control-Allow-Origin: " << req.origin << "\r\n"
-			<< "Access-Control-Allow-Credentials: true" << "\r\n"
-			<< "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload;" << "\r\n"
-			<< "X-Frame-Options: SAMEORIGIN" << "\r\n"
-			<<  "\r\n"
-			<< msg;
+	//blob opened by downloadFile
+	void send_download(http::request& req, int fd) noexcept
+	{
+		struct stat st;
+		fstat(fd, &st);
+		const std::string last_modified {http::format_http_date(st.st_mtime)};
+		const std::string disposition {"Content-Disposition: attachment; filename=\"" + t_user_info.fileName + "\";\r\n"};
+		const file_source file {nullptr, fd, static_cast<size_t>(st.st_size), st.st_mtime, t_user_info.contentType, "", last_modified, ""};
+		send_file(req, file, disposition);
 	}
 
 	inline void microservice(http::request& req) 
 	{
 
+		if (req.errcode == http::payload_too_large) {
+			send413(req);
+			return;
+		}
 		if (req.errcode == -1) {
 			send400(req);
 			return;
@@ -757,26 +1580,67 @@ namespace mse
 
 		t_user_info.clear();
 		t_user_info.ipAddr = req.remote_ip;
-		t_user_info.sessionID = req.cookie;
+		t_user_info.sessionID = std::string(req.cookie);
+		t_request = &req;
 
 		try {
 
 			if (req.path.size() > CPPSERVER_PATHSIZE_ALERT)
 				throw std::runtime_error("Invalid path length - buffer overflow attack?");
 
+			t_encoding = http::content_encoding::identity;
 			std::string& jsonOutput = t_service.run( req );
-			std::string contentType{ (t_user_info.contentType.empty()) ? json_encoding : t_user_info.contentType };
+			if (res.is_chunked()) {
+				if (t_encoding != http::content_encoding::identity) {
+					t_compressed.clear();
+					if (compress_body(jsonOutput, false, true))
+						res.write_chunk(t_compressed);
+				} else
+					res.write_chunk(jsonOutput);
+				res.end_chunked();
+				return;
+			}
+
+			if (t_download != -1) {
+				send_download(req, std::exchange(t_download, -1));
+				return;
+			}
+
+			const std::string& etag {t_service.etag()};
+			if (!etag.empty() && http::etag_matches(req.get_header(http::header::if_none_match), etag)) {
+				send_headers(req, res, not_modified_headers);
+				res << "ETag: " << etag << "\r\n";
+				if (const std::string_view vary {t_service.vary()}; !vary.empty())
+					res << "Vary: " << vary << "\r\n";
+				res << "\r\n";
+				return;
+			}
+
+			if (const snapshot_ptr& snap {t_service.snapshot()}) {
+				send_snapshot(req, snap, etag);
+				return;
+			}
+
+			const std::string_view contentType {(t_user_info.contentType.empty()) ? json_encoding : t_user_info.contentType};
+			std::string_view body {jsonOutput};
+			set_encoding(req, contentType, jsonOutput.size());
+			if (t_encoding != http::content_encoding::identity) {
+				t_compressed.clear();
+				if (compress_body(jsonOutput, true, true))
+					body = t_compressed;
+				else
+					t_encoding = http::content_encoding::identity;
+			}
 			
-			res	<< "HTTP/1.1 200 OK" << "\r\n"
-				<< "Content-Length: " << jsonOutput.size() << "\r\n" 
-				<< "Content-Type: " << contentType << "\r\n" 
-				<< "Date: " << http::get_response_date() << "\r\n" 
-				<< "Keep-Alive: timeout=5, max=200" << "\r\n"
-				<< "Access-Control-Allow-Origin: " << req.origin << "\r\n"
-				<< "Access-Control-Allow-Credentials: true" << "\r\n"
-				<< "Access-Control-Expose-Headers: content-disposition" << "\r\n"
-				<< "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload;" << "\r\n"
-				<< "X-Frame-Options: SAMEORIGIN" << "\r\n";
+			send_headers(req, res, ok_headers);
+			res	<< "Content-Length: " << body.size() << "\r\n" 
+				<< "Content-Type: " << contentType << "\r\n";
+			if (const std::string_view vary {t_service.vary()}; !vary.empty())
+				res << "Vary: " << vary << "\r\n";
+			if (t_encoding != http::content_encoding::identity)
+				res << "Content-Encoding: " << http::get_encoding_name(t_encoding) << "\r\n";
+			if (!etag.empty())
+				res << "ETag: " << etag << "\r\n";
 			
 			if (!t_user_info.fileName.empty()) {
 				std::string disposition{"attachment; filename=\"" + t_user_info.fileName + "\";"};
@@ -788,83 +1652,77 @@ namespace mse
 				res << "Set-Cookie: " << cookieHdr << "\r\n";
 			}
 			
-			set_trace_headers(req, res);
-			res << "\r\n" << jsonOutput;
+			res << "\r\n" << body;
 			
 		} catch (const LoginRequiredException&) {
-			logger::log("security", "error", "security session not found - IP: " + req.remote_ip + " cookie: " + req.cookie + " uri: " + req.path, true);
+			logger::log("security", "error", "security session not found - IP: " + req.remote_ip + " cookie: " + std::string(req.cookie) + " uri: " + std::string(req.path), true);
 			send401(req);
 		} catch (const std::exception& e) {
 			if (!req.path.ends_with(".ico"))
-				logger::log(LOGGER_SRC, "error", std::string(e.what()) + " uri: " + req.path + " user: " + t_user_info.userLogin, true);
+				logger::log(LOGGER_SRC, "error", std::string(e.what()) + " uri: " + std::string(req.path) + " user: " + t_user_info.userLogin, true);
+			
+			if (t_download != -1)
+				close(std::exchange(t_download, -1));
+
+			//headers already sent, close the connection so the client detects the incomplete response
+			if (res.is_chunked()) {
+				res.close_connection();
+				return;
+			}
 					
-			res << "HTTP/1.1 200 OK" << "\r\n"
-				<< "Content-Length: " << SYSERROR_RUNTIME.size() << "\r\n" 
+			send_headers(req, res, ok_headers);
+			res << "Content-Length: " << SYSERROR_RUNTIME.size() << "\r\n" 
 				<< "Content-Type: " << json_encoding << "\r\n" 
-				<< "Date: " << http::get_response_date() << "\r\n" 
-				<< "Keep-Alive: timeout=5, max=200" << "\r\n"
-				<< "Access-Control-Allow-Origin: " << req.origin << "\r\n"
-				<< "Access-Control-Allow-Credentials: true" << "\r\n"
-				<< "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload;" << "\r\n"
-				<< "X-Frame-Options: SAMEORIGIN" << "\r\n";		
-
-			set_trace_headers(req, res);
-			res << "\r\n" << SYSERROR_RUNTIME;
+				<< "\r\n" << SYSERROR_RUNTIME;
 		}
 
 	}
 
 	inline void fileservice(http::request& req) 
 	{
+		if (req.errcode == http::payload_too_large) {
+			send413(req);
+			return;
+		}
 		if (req.errcode == -1) {
 			send400(req);
 			return;
 		}
 		
-		std::string root_dir{ "/var/www" };
-		std::string target = root_dir + req.path;
+		std::string target = filecache::root_dir + std::string(req.path);
 		
 		if (target.back()=='/')
 			target += "index.html";
 		
-		if (std::filesystem::is_directory(std::filesystem::status(target))) {
-			target = req.path + "/index.html";
+		const int fd {open(target.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK)};
+		struct stat st;
+		if (fd == -1 || fstat(fd, &st) == -1 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) {
+			if (fd != -1)
+				close(fd);
+			send404(req);
+			return;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			close(fd);
+			target = std::string(req.path) + "/index.html";
 			sendRedirect(req, target);
 			return;
 		}
 
-		std::stringstream buffer;
-		{
-			std::ifstream file{target};
-			if (file.is_open())
-				buffer << file.rdbuf();
-			else {
-				send404(req);
-				return;
-			}
+		if (const auto cached {filecache::load(target, fd, st)}; cached) {
+			close(fd);
+			send_file(req, cached_source(cached));
+			return;
 		}
-		std::string page = buffer.str();
-		
-		http::response_stream& res = req.response;
-		res	<< "HTTP/1.1 200 OK" << "\r\n"
-			<< "Content-Length: " << page.size() << "\r\n" 
-			<< "Content-Type: " << http::get_content_type(target) << "\r\n"
-			<< "Date: " << http::get_response_date() << "\r\n"
-			<< "Keep-Alive: timeout=5, max=200" << "\r\n"
-			<< "Cache-Control: max-age=3600" << "\r\n" 
-			<< "Access-Control-Allow-Origin: " << req.origin << "\r\n"
-			<< "Access-Control-Allow-Credentials: true" << "\r\n"
-			<< "Access-Control-Expose-Headers: content-disposition" << "\r\n"
-			<< "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload;" << "\r\n"
-			<< "X-Frame-Options: SAMEORIGIN" << "\r\n";
-			set_trace_headers(req, req.response);
-		res	<< "\r\n";
-		res.append(page.data(), page.size());
+
+		const std::string last_modified {http::format_http_date(st.st_mtime)};
+		send_file(req, {nullptr, fd, static_cast<size_t>(st.st_size), st.st_mtime, http::get_content_type(target), "", last_modified, static_cache_control});
 	}
 
-	void init() noexcept
+	//connections are thread_local, every thread that runs queries must open its own
+	inline void connect_databases()
 	{
-		logger::log(LOGGER_SRC, "info", "starting microservice engine", true);
 		for (int i = 1; i <= 10; i++) 
 		{
 			std::string connstr{env::get_str("CPP_DB" + std::to_string(i))};
@@ -873,14 +1731,123 @@ namespace mse
 			else
 				break;
 		}
+	}
+
+	void init() noexcept
+	{
+		logger::log(LOGGER_SRC, "info", "starting microservice engine", true);
+		connect_databases();
 		t_service.init();
 	}
 
+	void listen(std::stop_token stop) noexcept
+	{
+		const config::listen_config& cfg {config::get_listen()};
+		if (cfg.channels.empty())
+			return;
+		std::string env_name {"CPP_" + cfg.db};
+		std::transform(env_name.begin(), env_name.end(), env_name.begin(), ::toupper);
+		const std::string conn_info {env::get_str(env_name)};
+		if (conn_info.empty()) {
+			logger::log(LOGGER_SRC, "error", "cache invalidation listener disabled, " + env_name + " is not defined");
+			return;
+		}
+		sql::listen(conn_info, cfg.channels, [](const std::string& channel, const std::string& payload) {
+			if (channel.empty()) {
+				logger::log(LOGGER_SRC, "warn", "notifications may have been lost, result cache cleared");
+				resultcache::clear();
+			} else
+				resultcache::invalidate(payload.empty() ? channel : payload);
+		}, stop);
+	}
+
+	//nullptr if the query fails, the previous snapshot is kept then
+	snapshot_ptr build_snapshot(const config::microService& ms) noexcept
+	{
+		try {
+			auto snap {std::make_shared<snapshot_response>()};
+			config::requestParameters params;
+			params.bind(ms.params);
+			ms.serviceFunction(snap->body, ms, params);
+			if (!is_ok(snap->body))
+				return nullptr;
+			if (ms.compress && snap->body.size() >= env::compress_min_size())
+				if (!http::compress(http::content_encoding::gzip, snap->body, snap->gzip, true, true))
+					snap->gzip.clear();
+			if (ms.etag)
+				snap->etag = http::get_etag(snap->body);
+			return snap;
+		} catch (const std::exception& e) {
+			logger::log(LOGGER_SRC, "error", "snapshot query failed: " + std::string(e.what()));
+			return nullptr;
+		}
+	}
+
+	bool load_snapshots(int signal_fd) noexcept
+	{
+		init_registry();
+		const auto registry {g_registry.load(std::memory_order_acquire)};
+		if (registry->snapshot_ids.empty())
+			return true;
+		connect_databases();
+		constexpr int retry_interval_ms {5000};
+		for (const int id: registry->snapshot_ids) {
+			const config::microService& ms {registry->services[id]};
+			while (true) {
+				if (auto snap {build_snapshot(ms)}) {
+					registry->snapshots[id].store(std::move(snap), std::memory_order_release);
+					break;
+				}
+				logger::log(LOGGER_SRC, "error", "cannot load snapshot, retrying in 5 seconds - db: " + ms.db + " sql: " + ms.sql);
+				//the epoll loop is not running yet, a stop signal is detected here
+				pollfd pfd {signal_fd, POLLIN, 0};
+				if (poll(&pfd, 1, retry_interval_ms) > 0) {
+					logger::log("signal", "info", "stop signal received while loading snapshots");
+					return false;
+				}
+			}
+		}
+		logger::log(LOGGER_SRC, "info", std::to_string(registry->snapshot_ids.size()) + " snapshot services loaded");
+		return true;
+	}
+
+	void refresh_snapshots(std::stop_token stop) noexcept
+	{
+		const auto registry {g_registry.load(std::memory_order_acquire)};
+		if (registry->snapshot_ids.empty())
+			return;
+		connect_databases();
+		using clock = std::chrono::steady_clock;
+		std::vector<clock::time_point> due;
+		for (const int id: registry->snapshot_ids)
+			due.push_back(clock::now() + std::chrono::milliseconds(registry->services[id].refresh_ms));
+		std::mutex mutex;
+		std::condition_variable_any wakeup;
+		while (!stop.stop_requested()) {
+			std::unique_lock lock {mutex};
+			wakeup.wait_until(lock, stop, *std::min_element(due.begin(), due.end()), [] { return false; });
+			if (stop.stop_requested())
+				break;
+			lock.unlock();
+			for (size_t i = 0; i < due.size(); i++) {
+				if (due[i] > clock::now())
+					continue;
+				const int id {registry->snapshot_ids[i]};
+				const config::microService& ms {registry->services[id]};
+				if (auto snap {build_snapshot(ms)})
+					registry->snapshots[id].store(std::move(snap), std::memory_order_release);
+				else
+					logger::log(LOGGER_SRC, "error", "cannot refresh snapshot, the previous one is kept - db: " + ms.db + " sql: " + ms.sql);
+				due[i] = clock::now() + std::chrono::milliseconds(ms.refresh_ms);
+			}
+		}
+	}
+
 	void http_server(int fd, http::request& req) noexcept
 	{
 		++g_active_threads;	
 
-		logger::set_request_id(req.get_header("x-request-id"));
+		logger::set_request_id(std::string(req.get_header(http::header::x_request_id)));
 
 		auto start = std::chrono::high_resolution_clock::now();
 
@@ -893,7 +1860,7 @@ namespace mse
 		std::chrono::duration <double>elapsed = finish - start;				
 
 		if (env::http_log_enabled())
-			logger::log("access-log", "info", "fd=" + std::to_string(fd) + " remote-ip=" + req.remote_ip + " path=" + req.path + " elapsed-time=" + std::to_string(elapsed.count()) + " cookie=" + req.cookie, true);
+			logger::log("access-log", "info", "fd=" + std::to_string(fd) + " remote-ip=" + req.remote_ip + " path=" + std::string(req.path) + " elapsed-time=" + std::to_string(elapsed.count()) + " cookie=" + std::string(req.cookie), true);
 
 		logger::set_request_id("");
 
@@ -901,5 +1868,66 @@ namespace mse
 		++g_counter;
 		--g_active_threads;
 	}
+
+	bool serve_preflight(http::request& req) noexcept
+	{
+		if (req.errcode != 0 || req.method != "OPTIONS")
+			return false;
+
+		//config.json has been parsed by the time the first request arrives
+		static const std::string preflight_headers {
+			[]() {
+				const config::cors_config& cors {config::get_cors()};
+				std::string headers {"HTTP/1.1 204 No Content\r\n" + keep_alive + common_headers};
+				headers.append("Access-Control-Allow-Methods: ").append(cors.allow_methods).append("\r\n");
+				headers.append("Access-Control-Max-Age: ").append(std::to_string(cors.max_age)).append("\r\n");
+				if (cors.allow_headers != "*")
+					headers.append("Access-Control-Allow-Headers: ").append(cors.allow_headers).append("\r\n")
+						.append("Vary: Origin\r\n");
+				else
+					headers.append("Vary: Origin, Access-Control-Request-Headers\r\n");
+				return headers;
+			}()
+		};
+
+		http::response_stream& res = req.response;
+		send_headers(req, res, preflight_headers);
+		if (config::get_cors().allow_headers == "*")
+			if (const auto requested {req.get_header(http::header::access_control_request_headers)}; !requested.empty())
+				res << "Access-Control-Allow-Headers: " << requested << "\r\n";
+		res << "\r\n";
+
+		if (env::http_log_enabled())
+			logger::log("access-log", "info", "fd=" + std::to_string(req.fd) + " remote-ip=" + req.remote_ip + " path=" + std::string(req.path) + " method=OPTIONS", true);
+
+		++g_counter;
+		return true;
+	}
+
+	bool serve_cached(http::request& req) noexcept
+	{
+		if (req.errcode != 0 || req.method != "GET" || req.path.starts_with("/ms/"))
+			return false;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		const auto file {filecache::find(req.path)};
+		if (!file)
+			return false;
+		send_file(req, cached_source(file));
+
+		auto finish = std::chrono::high_resolution_clock::now();
+		std::chrono::duration <double>elapsed = finish - start;				
+
+		if (env::http_log_enabled()) {
+			logger::set_request_id(std::string(req.get_header(http::header::x_request_id)));
+			logger::log("access-log", "info", "fd=" + std::to_string(req.fd) + " remote-ip=" + req.remote_ip + " path=" + std::string(req.path) + " elapsed-time=" + std::to_string(elapsed.count()) + " cookie=" + std::string(req.cookie) + " cache=hit", true);
+			logger::set_request_id("");
+		}
+
+		g_total_time += elapsed.count();
+		++g_counter;
+		return true;
+	}
 	
 }
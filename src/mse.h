@@ -1,5 +1,5 @@
 /*
- * mse - microservice engine - depends on logger env session sql login httputils json
+ * mse - microservice engine - depends on logger env session sql login httputils filecache json
  *
  *  Created on: Feb 26, 2023
  *      Author: Martin Cordova cppserver@martincordova.com - https://cppserver.com
@@ -15,6 +15,10 @@
 #include <unordered_map>
 #include <charconv>
 #include <functional>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <filesystem>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -24,6 +28,10 @@
 #include "sql.h"
 #include "session.h"
 #include "httputils.h"
+#include "filecache.h"
+#include "router.h"
+#include "resultcache.h"
+#include "singleflight.h"
 #include "config.h"
 #include "audit.h"
 #include "email.h"
@@ -33,7 +41,18 @@ namespace mse
 	constexpr char SERVER_VERSION[] = "cppserver-pgsql v1.2.5";
 	void init() noexcept;
 	void http_server(int fd, http::request& req) noexcept;
+	//answers a GET for a cached static file on the calling thread, returns false if it must go to http_server
+	bool serve_cached(http::request& req) noexcept;
+	//answers an OPTIONS request (CORS preflight) on the calling thread
+	bool serve_preflight(http::request& req) noexcept;
 	void update_connections(int n) noexcept;
+	//invalidates result cache keys notified by PostgreSQL on the channels of the "listen" block of config.json
+	void listen(std::stop_token stop) noexcept;
+	//runs the query of every "snapshot" service once, blocks until all of them succeed,
+	//false if a stop signal arrives on signal_fd while retrying
+	bool load_snapshots(int signal_fd) noexcept;
+	//rebuilds each snapshot every refresh_ms until stop is requested
+	void refresh_snapshots(std::stop_token stop) noexcept;
 }
 
 #endif /* MSE_H_ */
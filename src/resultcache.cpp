@@ -0,0 +1,149 @@
+#include "resultcache.h"
+
+namespace
+{
+	struct shard {
+		std::mutex mutex;
+		std::list<resultcache::entry_ptr> lru; //most recently used first
+		std::unordered_map<std::string_view, std::list<resultcache::entry_ptr>::iterator> index; //views over entry::key
+		size_t bytes {0};
+	};
+
+	std::array<shard, resultcache::shard_count> m_shards;
+	std::atomic<size_t> m_hits {0};
+	std::atomic<size_t> m_misses {0};
+	std::atomic<size_t> m_evictions {0};
+	std::atomic<size_t> m_invalidations {0};
+
+	struct string_hash {
+		using is_transparent = void;
+		size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+	};
+	//tags are never removed, the nodes of an unordered_map do not move so entries can point to the counters
+	std::unordered_map<std::string, std::atomic<uint64_t>, string_hash, std::equal_to<>> m_tags;
+	std::shared_mutex m_tags_mutex;
+	std::atomic<uint64_t> m_epoch {0}; //version shared by all the entries, incremented by clear()
+
+	inline bool is_current(const resultcache::tag_versions& tags) noexcept
+	{
+		for (const auto& [version, seen]: tags)
+			if (version->load(std::memory_order_acquire) != seen)
+				return false;
+		return true;
+	}
+
+	inline shard& get_shard(std::string_view key) noexcept
+	{
+		return m_shards[http::hash64(key) % resultcache::shard_count];
+	}
+
+	//caller holds the shard lock
+	inline void remove(shard& s, std::list<resultcache::entry_ptr>::iterator it) noexcept
+	{
+		s.bytes -= (*it)->cost();
+		s.index.erase((*it)->key);
+		s.lru.erase(it);
+	}
+}
+
+namespace resultcache
+{
+	size_t entry::cost() const noexcept
+	{
+		return sizeof(entry) + key.size() + body.size() + tags.size() * sizeof(tag_versions::value_type);
+	}
+
+	entry_ptr find(std::string_view key) noexcept
+	{
+		if (env::result_cache_size() == 0)
+			return nullptr;
+		shard& s {get_shard(key)};
+		std::lock_guard lock {s.mutex};
+		auto it = s.index.find(key);
+		if (it == s.index.end()) {
+			++m_misses;
+			return nullptr;
+		}
+		if ((*it->second)->expires <= std::chrono::steady_clock::now() || !is_current((*it->second)->tags)) {
+			remove(s, it->second);
+			++m_misses;
+			return nullptr;
+		}
+		s.lru.splice(s.lru.begin(), s.lru, it->second);
+		++m_hits;
+		return s.lru.front();
+	}
+
+	tag_versions get_versions(const std::vector<std::string>& tags) noexcept
+	{
+		tag_versions result;
+		result.reserve(tags.size() + 1);
+		result.emplace_back(&m_epoch, m_epoch.load(std::memory_order_acquire));
+		for (const auto& tag: tags) {
+			{
+				std::shared_lock lock {m_tags_mutex};
+				if (auto it = m_tags.find(tag); it != m_tags.end()) {
+					result.emplace_back(&it->second, it->second.load(std::memory_order_acquire));
+					continue;
+				}
+			}
+			std::unique_lock lock {m_tags_mutex};
+			auto it {m_tags.try_emplace(tag, 0).first};
+			result.emplace_back(&it->second, it->second.load(std::memory_order_acquire));
+		}
+		return result;
+	}
+
+	void insert(std::string_view key, std::string_view body, std::chrono::milliseconds ttl, tag_versions&& tags) noexcept
+	{
+		const size_t budget {env::result_cache_size() / shard_count};
+		if (!is_current(tags))
+			return;
+		auto e {std::make_shared<entry>(std::string(key), std::string(body), std::chrono::steady_clock::now() + ttl, std::move(tags))};
+		const size_t cost {e->cost()};
+		if (cost > budget)
+			return;
+		shard& s {get_shard(key)};
+		std::lock_guard lock {s.mutex};
+		if (auto it = s.index.find(key); it != s.index.end())
+			remove(s, it->second);
+		while (s.bytes + cost > budget) {
+			remove(s, std::prev(s.lru.end()));
+			++m_evictions;
+		}
+		s.lru.push_front(std::move(e));
+		s.index.emplace(s.lru.front()->key, s.lru.begin());
+		s.bytes += cost;
+	}
+
+	void invalidate(std::string_view tag) noexcept
+	{
+		std::shared_lock lock {m_tags_mutex};
+		if (auto it = m_tags.find(tag); it != m_tags.end())
+			it->second.fetch_add(1, std::memory_order_acq_rel);
+		++m_invalidations;
+	}
+
+	void clear() noexcept
+	{
+		m_epoch.fetch_add(1, std::memory_order_acq_rel);
+		for (auto& s: m_shards) {
+			std::lock_guard lock {s.mutex};
+			s.index.clear();
+			s.lru.clear();
+			s.bytes = 0;
+		}
+		++m_invalidations;
+	}
+
+	stats get_stats() noexcept
+	{
+		stats result {m_hits, m_misses, m_evictions, m_invalidations, 0, 0};
+		for (auto& s: m_shards) {
+			std::lock_guard lock {s.mutex};
+			result.bytes += s.bytes;
+			result.entries += s.lru.size();
+		}
+		return result;
+	}
+}
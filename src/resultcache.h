@@ -0,0 +1,65 @@
+/*
+ * resultcache - process-wide cache of microservice responses with TTL, sharded LRU under a global memory budget
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Martin Cordova cppserver@martincordova.com - https://cppserver.com
+ *      Disclaimer: some parts of this library may have been taken from sample code publicly available
+ *		and written by third parties. Free to use in commercial projects, no warranties and no responsabilities assumed
+ *		by the author, use at your own risk. By using this code you accept the forementioned conditions.
+ */
+#ifndef RESULTCACHE_H_
+#define RESULTCACHE_H_
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <list>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <chrono>
+#include "env.h"
+#include "httputils.h"
+
+namespace resultcache
+{
+	constexpr size_t shard_count {16}; //each shard has its own lock and 1/16 of the budget
+
+	//version of each tag of a service when its query started, invalidating a tag increments its version
+	//and the entries that saw the old one are dropped when they are found
+	using tag_versions = std::vector<std::pair<const std::atomic<uint64_t>*, uint64_t>>;
+
+	struct entry {
+		std::string key;
+		std::string body;
+		std::chrono::steady_clock::time_point expires;
+		tag_versions tags;
+		size_t cost() const noexcept;
+	};
+	using entry_ptr = std::shared_ptr<const entry>;
+
+	struct stats {
+		size_t hits;
+		size_t misses;
+		size_t evictions;
+		size_t invalidations;
+		size_t bytes;
+		size_t entries;
+	};
+
+	//nullptr if the key is not cached, its TTL expired or one of its tags was invalidated
+	entry_ptr find(std::string_view key) noexcept;
+	//must be called before the service runs, a result computed while one of its tags gets invalidated or the cache is cleared is not kept
+	tag_versions get_versions(const std::vector<std::string>& tags) noexcept;
+	void insert(std::string_view key, std::string_view body, std::chrono::milliseconds ttl, tag_versions&& tags) noexcept;
+	//drops every entry of the tag, O(1), the entries are removed when they are found or evicted
+	void invalidate(std::string_view tag) noexcept;
+	//drops every entry
+	void clear() noexcept;
+	stats get_stats() noexcept;
+}
+
+#endif /* RESULTCACHE_H_ */
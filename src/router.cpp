@@ -0,0 +1,157 @@
+#include "router.h"
+
+namespace router
+{
+	table::table(const std::vector<std::string>& uris)
+	{
+		std::vector<std::pair<std::string_view, int>> exact;
+		exact.reserve(uris.size());
+		for (size_t i = 0; i < uris.size(); i++) {
+			if (uris[i].find('{') == std::string::npos)
+				exact.emplace_back(uris[i], i);
+			else
+				add_template(uris[i], i);
+		}
+		add_exact(exact);
+	}
+
+	//buckets of keys by their unseeded hash, each bucket searches a seed that sends all its keys to free slots,
+	//larger buckets go first while most slots are still free, single-key buckets take any free slot directly
+	void table::add_exact(const std::vector<std::pair<std::string_view, int>>& routes)
+	{
+		const size_t n {routes.size()};
+		if (n == 0)
+			return;
+		m_keys.resize(n);
+		m_ids.assign(n, -1);
+		m_displacements.assign(std::max<size_t>(1, n / 2), 0);
+
+		std::vector<std::vector<size_t>> buckets(m_displacements.size());
+		for (size_t i = 0; i < n; i++)
+			buckets[http::hash64(routes[i].first) % buckets.size()].push_back(i);
+		std::vector<size_t> order(buckets.size());
+		for (size_t b = 0; b < order.size(); b++)
+			order[b] = b;
+		std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+		std::vector<bool> used(n, false);
+		std::vector<size_t> slots;
+		auto assign = [&](size_t slot, size_t route) {
+			used[slot] = true;
+			m_keys[slot] = routes[route].first;
+			m_ids[slot] = routes[route].second;
+		};
+		for (const size_t b: order) {
+			const std::vector<size_t>& keys {buckets[b]};
+			if (keys.size() < 2)
+				break;
+			for (uint64_t seed = 1; ; seed++) {
+				if (seed > 1000000)
+					throw std::runtime_error("router: cannot build the route table, duplicated uri: " + std::string(routes[keys[0]].first));
+				slots.clear();
+				for (const size_t k: keys) {
+					const size_t slot {http::hash64(routes[k].first, seed) % n};
+					if (used[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end())
+						break;
+					slots.push_back(slot);
+				}
+				if (slots.size() == keys.size()) {
+					for (size_t j = 0; j < keys.size(); j++)
+						assign(slots[j], keys[j]);
+					m_displacements[b] = seed;
+					break;
+				}
+			}
+		}
+		size_t free {0};
+		for (const size_t b: order) {
+			if (buckets[b].size() != 1)
+				continue;
+			while (used[free])
+				free++;
+			assign(free, buckets[b][0]);
+			m_displacements[b] = -static_cast<int64_t>(free) - 1;
+		}
+	}
+
+	void table::add_template(std::string_view uri, int id)
+	{
+		if (m_nodes.empty())
+			m_nodes.emplace_back();
+		size_t n {0};
+		std::string_view rest {uri};
+		while (!rest.empty()) {
+			rest.remove_prefix(1);
+			const size_t end {rest.find('/')};
+			const std::string_view segment {rest.substr(0, end)};
+			rest = (end == std::string_view::npos) ? std::string_view{} : rest.substr(end);
+			if (segment.size() > 2 && segment.front() == '{' && segment.back() == '}') {
+				const std::string_view name {segment.substr(1, segment.size() - 2)};
+				if (m_nodes[n].param == 0) {
+					const size_t child {m_nodes.size()};
+					m_nodes[n].param = child;
+					m_nodes[n].param_name = name;
+					m_nodes.emplace_back();
+				} else if (m_nodes[n].param_name != name)
+					throw std::runtime_error("router: path parameter {" + std::string(name) + "} conflicts with {"
+						+ m_nodes[n].param_name + "} in uri: " + std::string(uri));
+				n = m_nodes[n].param;
+			} else if (auto it = m_nodes[n].children.find(segment); it != m_nodes[n].children.end()) {
+				n = it->second;
+			} else {
+				const size_t child {m_nodes.size()};
+				m_nodes[n].children.emplace(segment, child);
+				m_nodes.emplace_back();
+				n = child;
+			}
+		}
+		if (m_nodes[n].id != -1)
+			throw std::runtime_error("router: duplicated uri: " + std::string(uri));
+		m_nodes[n].id = id;
+	}
+
+	//path is the remainder of the request path starting at a '/', literal segments are preferred over parameters
+	int table::match(size_t n, std::string_view path, std::array<capture, max_captures>& captures, size_t count, size_t& total) const noexcept
+	{
+		const node& current {m_nodes[n]};
+		if (path.empty()) {
+			total = count;
+			return current.id;
+		}
+		path.remove_prefix(1);
+		const size_t end {path.find('/')};
+		const std::string_view segment {path.substr(0, end)};
+		const std::string_view rest {(end == std::string_view::npos) ? std::string_view{} : path.substr(end)};
+		if (auto it = current.children.find(segment); it != current.children.end())
+			if (const int id {match(it->second, rest, captures, count, total)}; id != -1)
+				return id;
+		if (current.param != 0 && !segment.empty() && count < max_captures) {
+			captures[count] = {current.param_name, segment};
+			return match(current.param, rest, captures, count + 1, total);
+		}
+		return -1;
+	}
+
+	int table::find(std::string_view path, std::unordered_map<std::string, std::string>& params) const noexcept
+	{
+		if (!m_keys.empty()) {
+			const int64_t d {m_displacements[http::hash64(path) % m_displacements.size()]};
+			const size_t slot {(d < 0) ? static_cast<size_t>(-d - 1) : http::hash64(path, d) % m_keys.size()};
+			if (m_keys[slot] == path)
+				return m_ids[slot];
+		}
+		if (m_nodes.empty() || !path.starts_with('/'))
+			return -1;
+		std::array<capture, max_captures> captures;
+		size_t total {0};
+		const int id {match(0, path, captures, 0, total)};
+		if (id != -1) {
+			for (size_t i = 0; i < total; i++) {
+				std::string& value {params[std::string(captures[i].name)]};
+				value.clear();
+				scan::url_decode(captures[i].value, value);
+			}
+		}
+		return id;
+	}
+}
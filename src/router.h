@@ -0,0 +1,65 @@
+/*
+ * router - route table compiled from the service URIs, perfect hash for exact paths and a segment trie for path templates
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Martin Cordova cppserver@martincordova.com - https://cppserver.com
+ *      Disclaimer: some parts of this library may have been taken from sample code publicly available
+ *		and written by third parties. Free to use in commercial projects, no warranties and no responsabilities assumed
+ *		by the author, use at your own risk. By using this code you accept the forementioned conditions.
+ */
+#ifndef ROUTER_H_
+#define ROUTER_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include "httputils.h"
+#include "scan.h"
+
+namespace router
+{
+	struct string_hash {
+		using is_transparent = void;
+		size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+	};
+
+	//immutable after construction, safe to share between threads
+	class table {
+	  public:
+		table() = default;
+		//the route id is the index of the uri, a segment like {name} is a path template parameter
+		explicit table(const std::vector<std::string>& uris);
+		//route id or -1, the values of the template parameters are added to params
+		int find(std::string_view path, std::unordered_map<std::string, std::string>& params) const noexcept;
+
+	  private:
+		static constexpr size_t max_captures {16};
+		struct capture {
+			std::string_view name;
+			std::string_view value;
+		};
+		struct node {
+			std::unordered_map<std::string, size_t, string_hash, std::equal_to<>> children;
+			size_t param {0}; //child node for a {name} segment, 0 if none
+			std::string param_name;
+			int id {-1};
+		};
+
+		//exact paths: hash-and-displace, one slot per key and at most two hashes per lookup
+		std::vector<std::string> m_keys;
+		std::vector<int> m_ids;
+		std::vector<int64_t> m_displacements; //seed of the bucket, or -slot-1 for buckets with a single key
+		//templates, m_nodes[0] is the root
+		std::vector<node> m_nodes;
+
+		void add_exact(const std::vector<std::pair<std::string_view, int>>& routes);
+		void add_template(std::string_view uri, int id);
+		int match(size_t n, std::string_view path, std::array<capture, max_captures>& captures, size_t count, size_t& total) const noexcept;
+	};
+}
+
+#endif /* ROUTER_H_ */
@@ -0,0 +1,266 @@
+#include "scan.h"
+
+#if defined(__x86_64__)
+	#include <immintrin.h>
+#endif
+
+namespace
+{
+	constexpr size_t npos {std::string_view::npos};
+
+	using find_char_fn = size_t (*)(const char* p, size_t n, char c) noexcept;
+	using find_any2_fn = size_t (*)(const char* p, size_t n, char c1, char c2) noexcept;
+	using find_crlf_fn = size_t (*)(const char* p, size_t n) noexcept;
+
+	constexpr std::array<signed char, 256> hex_values {
+		[]() {
+			std::array<signed char, 256> t{};
+			t.fill(-1);
+			for (int i = 0; i < 10; i++) t['0' + i] = i;
+			for (int i = 0; i < 6; i++) {
+				t['a' + i] = 10 + i;
+				t['A' + i] = 10 + i;
+			}
+			return t;
+		}()
+	};
+
+	/* scalar kernels, also used for the tail of the vector kernels */
+	size_t find_char_scalar(const char* p, size_t n, char c) noexcept
+	{
+		if (auto r = static_cast<const char*>(std::memchr(p, c, n)))
+			return r - p;
+		return npos;
+	}
+
+	inline size_t find_char_tail(const char* p, size_t n, char c) noexcept
+	{
+		for (size_t i = 0; i < n; i++)
+			if (p[i] == c)
+				return i;
+		return npos;
+	}
+
+	inline size_t find_crlf_tail(const char* p, size_t n) noexcept
+	{
+		for (size_t i = 0; i + 1 < n; i++)
+			if (p[i] == '\r' && p[i + 1] == '\n')
+				return i;
+		return npos;
+	}
+
+	size_t find_any2_scalar(const char* p, size_t n, char c1, char c2) noexcept
+	{
+		for (size_t i = 0; i < n; i++)
+			if (p[i] == c1 || p[i] == c2)
+				return i;
+		return npos;
+	}
+
+	size_t find_crlf_scalar(const char* p, size_t n) noexcept
+	{
+		size_t i {0};
+		while (i + 1 < n) {
+			auto r = static_cast<const char*>(std::memchr(p + i, '\r', n - i - 1));
+			if (!r)
+				return npos;
+			i = r - p;
+			if (p[i + 1] == '\n')
+				return i;
+			i++;
+		}
+		return npos;
+	}
+
+	inline size_t tail(size_t i, size_t r) noexcept
+	{
+		return (r == npos) ? npos : i + r;
+	}
+
+#if defined(__x86_64__)
+	/* SSE2 kernels, part of the x86-64 baseline */
+	size_t find_char_sse2(const char* p, size_t n, char c) noexcept
+	{
+		const __m128i needle {_mm_set1_epi8(c)};
+		size_t i {0};
+		for (; i + 16 <= n; i += 16) {
+			const __m128i v {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))};
+			if (int m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)))
+				return i + __builtin_ctz(m);
+		}
+		return tail(i, find_char_tail(p + i, n - i, c));
+	}
+
+	size_t find_any2_sse2(const char* p, size_t n, char c1, char c2) noexcept
+	{
+		const __m128i n1 {_mm_set1_epi8(c1)};
+		const __m128i n2 {_mm_set1_epi8(c2)};
+		size_t i {0};
+		for (; i + 16 <= n; i += 16) {
+			const __m128i v {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))};
+			if (int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, n1), _mm_cmpeq_epi8(v, n2))))
+				return i + __builtin_ctz(m);
+		}
+		return tail(i, find_any2_scalar(p + i, n - i, c1, c2));
+	}
+
+	size_t find_crlf_sse2(const char* p, size_t n) noexcept
+	{
+		const __m128i cr {_mm_set1_epi8('\r')};
+		const __m128i lf {_mm_set1_epi8('\n')};
+		size_t i {0};
+		for (; i + 17 <= n; i += 16) {
+			const __m128i v1 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))};
+			const __m128i v2 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1))};
+			if (int m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v1, cr), _mm_cmpeq_epi8(v2, lf))))
+				return i + __builtin_ctz(m);
+		}
+		return tail(i, find_crlf_tail(p + i, n - i));
+	}
+
+	/* AVX2 kernels */
+	__attribute__((target("avx2")))
+	size_t find_char_avx2(const char* p, size_t n, char c) noexcept
+	{
+		const __m256i needle {_mm256_set1_epi8(c)};
+		size_t i {0};
+		for (; i + 32 <= n; i += 32) {
+			const __m256i v {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i))};
+			if (unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)))
+				return i + __builtin_ctz(m);
+		}
+		if (i + 16 <= n) {
+			const __m128i v {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))};
+			if (int m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(needle))))
+				return i + __builtin_ctz(m);
+			i += 16;
+		}
+		return tail(i, find_char_tail(p + i, n - i, c));
+	}
+
+	__attribute__((target("avx2")))
+	size_t find_any2_avx2(const char* p, size_t n, char c1, char c2) noexcept
+	{
+		const __m256i n1 {_mm256_set1_epi8(c1)};
+		const __m256i n2 {_mm256_set1_epi8(c2)};
+		size_t i {0};
+		for (; i + 32 <= n; i += 32) {
+			const __m256i v {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i))};
+			if (unsigned m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, n1), _mm256_cmpeq_epi8(v, n2))))
+				return i + __builtin_ctz(m);
+		}
+		if (i + 16 <= n) {
+			const __m128i v {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))};
+			const __m128i m1 {_mm_cmpeq_epi8(v, _mm256_castsi256_si128(n1))};
+			const __m128i m2 {_mm_cmpeq_epi8(v, _mm256_castsi256_si128(n2))};
+			if (int m = _mm_movemask_epi8(_mm_or_si128(m1, m2)))
+				return i + __builtin_ctz(m);
+			i += 16;
+		}
+		return tail(i, find_any2_scalar(p + i, n - i, c1, c2));
+	}
+
+	__attribute__((target("avx2")))
+	size_t find_crlf_avx2(const char* p, size_t n) noexcept
+	{
+		const __m256i cr {_mm256_set1_epi8('\r')};
+		const __m256i lf {_mm256_set1_epi8('\n')};
+		size_t i {0};
+		for (; i + 33 <= n; i += 32) {
+			const __m256i v1 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i))};
+			const __m256i v2 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 1))};
+			if (unsigned m = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v1, cr), _mm256_cmpeq_epi8(v2, lf))))
+				return i + __builtin_ctz(m);
+		}
+		if (i + 17 <= n) {
+			const __m128i v1 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))};
+			const __m128i v2 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1))};
+			const __m128i m1 {_mm_cmpeq_epi8(v1, _mm256_castsi256_si128(cr))};
+			const __m128i m2 {_mm_cmpeq_epi8(v2, _mm256_castsi256_si128(lf))};
+			if (int m = _mm_movemask_epi8(_mm_and_si128(m1, m2)))
+				return i + __builtin_ctz(m);
+			i += 16;
+		}
+		return tail(i, find_crlf_tail(p + i, n - i));
+	}
+#endif
+
+	struct kernels
+	{
+		find_char_fn find_char;
+		find_any2_fn find_any2;
+		find_crlf_fn find_crlf;
+		std::string_view name;
+	};
+
+	kernels select_kernels() noexcept
+	{
+	#if defined(__x86_64__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return {find_char_avx2, find_any2_avx2, find_crlf_avx2, "avx2"};
+		return {find_char_sse2, find_any2_sse2, find_crlf_sse2, "sse2"};
+	#endif
+		return {find_char_scalar, find_any2_scalar, find_crlf_scalar, "scalar"};
+	}
+
+	const kernels k {select_kernels()};
+}
+
+namespace scan
+{
+	size_t find_char(std::string_view s, char c, size_t pos) noexcept
+	{
+		if (pos >= s.size())
+			return npos;
+		return tail(pos, k.find_char(s.data() + pos, s.size() - pos, c));
+	}
+
+	size_t find_first_of(std::string_view s, char c1, char c2, size_t pos) noexcept
+	{
+		if (pos >= s.size())
+			return npos;
+		return tail(pos, k.find_any2(s.data() + pos, s.size() - pos, c1, c2));
+	}
+
+	size_t find_crlf(std::string_view s, size_t pos) noexcept
+	{
+		if (pos >= s.size())
+			return npos;
+		return tail(pos, k.find_crlf(s.data() + pos, s.size() - pos));
+	}
+
+	void url_decode(std::string_view in, std::string& out) noexcept
+	{
+		out.reserve(out.size() + in.size());
+		size_t pos {0};
+		while (pos < in.size()) {
+			const size_t next {find_first_of(in, '%', '+', pos)};
+			if (next == npos) {
+				out.append(in.substr(pos));
+				return;
+			}
+			out.append(in.data() + pos, next - pos);
+			pos = next + 1;
+			if (in[next] == '+') {
+				out.push_back(' ');
+				continue;
+			}
+			if (next + 2 < in.size()) {
+				const int hi {hex_values[static_cast<unsigned char>(in[next + 1])]};
+				const int lo {hex_values[static_cast<unsigned char>(in[next + 2])]};
+				if (hi >= 0 && lo >= 0) {
+					out.push_back(static_cast<char>((hi << 4) | lo));
+					pos = next + 3;
+					continue;
+				}
+			}
+			out.push_back('%');
+		}
+	}
+
+	std::string_view get_kernel_name() noexcept
+	{
+		return k.name;
+	}
+}
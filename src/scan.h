@@ -0,0 +1,30 @@
+/*
+ * scan - byte scanning kernels for the http parser (SSE2/AVX2, scalar outside x86-64, selected at runtime)
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Martin Cordova cppserver@martincordova.com - https://cppserver.com
+ *      Disclaimer: some parts of this library may have been taken from sample code publicly available
+ *		and written by third parties. Free to use in commercial projects, no warranties and no responsabilities assumed
+ *		by the author, use at your own risk. By using this code you accept the forementioned conditions.
+ */
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <string>
+#include <string_view>
+#include <array>
+#include <cstring>
+#include "logger.h"
+
+namespace scan
+{
+	//all functions return std::string_view::npos if there is no match
+	size_t find_char(std::string_view s, char c, size_t pos = 0) noexcept;
+	size_t find_first_of(std::string_view s, char c1, char c2, size_t pos = 0) noexcept;
+	size_t find_crlf(std::string_view s, size_t pos = 0) noexcept;
+	//percent-decoding, '+' is decoded as space, appends to out
+	void url_decode(std::string_view in, std::string& out) noexcept;
+	std::string_view get_kernel_name() noexcept;
+}
+
+#endif /* SCAN_H_ */
@@ -0,0 +1,87 @@
+#include "singleflight.h"
+
+namespace
+{
+	struct call {
+		std::mutex mutex;
+		std::condition_variable done_cv;
+		bool done {false};
+		bool failed {false};
+		std::string result;
+	};
+
+	struct string_hash {
+		using is_transparent = void;
+		size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+	};
+
+	//calls in flight, an entry lives only while its work runs
+	std::unordered_map<std::string, std::shared_ptr<call>, string_hash, std::equal_to<>> m_calls;
+	std::mutex m_mutex;
+	std::atomic<size_t> m_count {0};
+	std::atomic<size_t> m_shared {0};
+
+	inline void finish(std::string_view key, call& c, bool failed) noexcept
+	{
+		{
+			std::lock_guard lock {m_mutex};
+			m_calls.erase(m_calls.find(key));
+		}
+		{
+			std::lock_guard lock {c.mutex};
+			c.done = true;
+			c.failed = failed;
+		}
+		c.done_cv.notify_all();
+	}
+}
+
+namespace singleflight
+{
+	void run(std::string_view key, std::string& result, const std::function<void(std::string&)>& work)
+	{
+		std::shared_ptr<call> c;
+		bool leader {false};
+		{
+			std::lock_guard lock {m_mutex};
+			if (auto it = m_calls.find(key); it != m_calls.end())
+				c = it->second;
+			else {
+				c = std::make_shared<call>();
+				m_calls.emplace(key, c);
+				leader = true;
+			}
+		}
+
+		if (!leader) {
+			std::unique_lock lock {c->mutex};
+			c->done_cv.wait(lock, [&c] { return c->done; });
+			if (!c->failed) {
+				result.append(c->result);
+				++m_shared;
+				return;
+			}
+			lock.unlock();
+			work(result);
+			++m_count;
+			return;
+		}
+
+		const size_t offset {result.size()};
+		try {
+			work(result);
+		} catch (...) {
+			finish(key, *c, true);
+			throw;
+		}
+		++m_count;
+		//followers read the result only after done is set under the call's lock
+		c->result.assign(result, offset);
+		finish(key, *c, false);
+	}
+
+	stats get_stats() noexcept
+	{
+		return {m_count, m_shared};
+	}
+}
@@ -0,0 +1,35 @@
+/*
+ * singleflight - coalesces identical concurrent calls, the first caller for a key runs the work and the others reuse its result
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Martin Cordova cppserver@martincordova.com - https://cppserver.com
+ *      Disclaimer: some parts of this library may have been taken from sample code publicly available
+ *		and written by third parties. Free to use in commercial projects, no warranties and no responsabilities assumed
+ *		by the author, use at your own risk. By using this code you accept the forementioned conditions.
+ */
+#ifndef SINGLEFLIGHT_H_
+#define SINGLEFLIGHT_H_
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace singleflight
+{
+	struct stats {
+		size_t calls; //times the work was executed
+		size_t shared; //callers that reused the result of a call in flight, each one is a database call saved
+	};
+
+	//appends to result the output of work, if another thread is running work for the same key it waits and appends a copy of that output,
+	//if that call fails with an exception the waiting threads run work themselves
+	void run(std::string_view key, std::string& result, const std::function<void(std::string&)>& work);
+	stats get_stats() noexcept;
+}
+
+#endif /* SINGLEFLIGHT_H_ */
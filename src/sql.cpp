@@ -17,6 +17,15 @@ namespace sql
 		return msg;
 	}
 
+	//parameter and result column types of a prepared statement
+	struct statement_types
+	{
+		std::vector<Oid> params;
+		std::vector<Oid> columns;
+		bool text {false}; //the server refused to prepare it, it runs with its values spliced as literals
+		bool stale {false}; //its plan is no longer valid, it gets deallocated and prepared again on its next use
+	};
+
 	struct dbutil 
 	{
 		
@@ -34,7 +43,10 @@ namespace sql
 				logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
 		}
 		
-		dbutil(dbutil &&source) : m_dbconnstr{source.m_dbconnstr}, conn{source.conn}
+		//statements prepared on this connection and the types inferred by the server
+		std::unordered_map<std::string, statement_types> prepared;
+
+		dbutil(dbutil &&source) : m_dbconnstr{source.m_dbconnstr}, conn{source.conn}, prepared{std::move(source.prepared)}
 		{
 			source.conn = nullptr;
 		}
@@ -48,11 +60,13 @@ namespace sql
 				PQfinish(conn);
 		}
 		
-		inline void reset_connection() noexcept
+		//force reopens a connection that is still valid, like one left in the middle of a pipeline
+		inline void reset_connection(bool force = false) noexcept
 		{
-			if ( PQstatus(conn) == CONNECTION_BAD ) {
+			if ( force || PQstatus(conn) == CONNECTION_BAD ) {
 				logger::log(LOGGER_SRC, "warn", std::string(__FUNCTION__) + ": connection to database " + std::string(PQdb(conn)) + " no longer valid, reconnecting... ", true);
 				PQfinish(conn);
+				prepared.clear();
 				conn = PQconnectdb(m_dbconnstr.c_str());
 				if (PQstatus(conn) != CONNECTION_OK)
 					logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": error reconnecting to database " + std::string(PQdb(conn)) + " - " + get_error(conn), true);
@@ -70,38 +84,62 @@ namespace sql
 	constexpr int PG_TIMESTAMP = 1114;
 	constexpr int PG_VARCHAR = 1043;
 	constexpr int PG_TEXT = 25;
+	constexpr int PG_INT2 = 21;
+	constexpr int PG_INT4 = 23;
+	constexpr int PG_INT8 = 20;
+	constexpr int PG_FLOAT4 = 700;
+	constexpr int PG_FLOAT8 = 701;
+	constexpr int PG_BOOL = 16;
 	
+	inline void get_json_row(std::string& json, PGresult *res, int row) noexcept 
+	{
+		int cols {PQnfields(res)};
+		json.append("{");
+		for(int j=0; j<cols; j++) {
+			json.append("\"").append(PQfname(res, j)).append("\":");
+			Oid coltype = PQftype(res, j);
+			switch (coltype) 
+			{
+				case PG_VARCHAR:
+				case PG_TEXT:
+				case PG_DATE:
+				case PG_TIMESTAMP:
+					json.append("\"").append(PQgetvalue(res, row, j)).append("\",");
+					break;
+				default:
+					json.append(PQgetvalue(res, row, j)).append(",");
+					break;
+			}
+		}
+		json.pop_back();
+		json.append("}");
+	}
+
 	inline void get_json_array(std::string& json, PGresult *res) noexcept 
 	{
 		json.append("[");
 		int rows {PQntuples(res)};
-		int cols {PQnfields(res)};
 		for(int i=0; i<rows; i++) {
-			json.append("{");
-			for(int j=0; j<cols; j++) {
-				json.append("\"").append(PQfname(res, j)).append("\":");
-				Oid coltype = PQftype(res, j);
-				switch (coltype) 
-				{
-					case PG_VARCHAR:
-					case PG_TEXT:
-					case PG_DATE:
-					case PG_TIMESTAMP:
-						json.append("\"").append(PQgetvalue(res, i, j)).append("\",");
-						break;
-					default:
-						json.append(PQgetvalue(res, i, j)).append(",");
-						break;
-				}
-			}
-			json.pop_back();
-			json.append("},");
+			get_json_row(json, res, i);
+			json.append(",");
 		}
 		if (rows > 0) 
 			json.pop_back();
 		json.append("]");
 	}
 
+	//abort a running query and discard its pending results
+	inline void cancel_query(PGconn* conn) noexcept
+	{
+		if (PGcancel* c = PQgetCancel(conn)) {
+			std::array<char, 256> errbuf{0};
+			PQcancel(c, errbuf.data(), errbuf.size());
+			PQfreeCancel(c);
+		}
+		while (PGresult* res = PQgetResult(conn))
+			PQclear(res);
+	}
+
 
 	void connect(const std::string& dbname, const std::string& conn_info)
 	{
@@ -115,29 +153,391 @@ namespace sql
 	}
 
 
-	PGconn* getdb(const std::string& dbname)
+	dbutil& getdb(const std::string& dbname)
 	{
-		if (!dbconns.contains(dbname)) {
-			std::string error{std::string(__FUNCTION__) + ": invalid dbname: " + dbname};
-			throw std::runtime_error(error.c_str());
+		if (auto it = dbconns.find(dbname); it != dbconns.end())
+			return it->second;
+		std::string error{std::string(__FUNCTION__) + ": invalid dbname: " + dbname};
+		throw std::runtime_error(error.c_str());
+	}
+
+	template<typename T>
+	inline void store_binary(T value, std::array<char, 8>& out, int& length) noexcept
+	{
+		if constexpr (std::endian::native == std::endian::little)
+			value = std::byteswap(value);
+		std::memcpy(out.data(), &value, sizeof(T));
+		length = sizeof(T);
+	}
+
+	template<typename T>
+	inline bool parse_number(std::string_view s, T& value) noexcept
+	{
+		auto [ptr, ec] {std::from_chars(s.data(), s.data() + s.size(), value)};
+		return ec == std::errc() && ptr == s.data() + s.size();
+	}
+
+	//MessagePack encoding, the smallest representation of each value, multi-byte values in big-endian order
+	template<typename T>
+	inline void msgpack_be(std::string& out, T value) noexcept
+	{
+		if constexpr (std::endian::native == std::endian::little)
+			value = std::byteswap(value);
+		out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	inline void msgpack_int(std::string& out, int64_t v) noexcept
+	{
+		if (v >= -32 && v <= 127) //positive and negative fixint
+			out.push_back(static_cast<char>(v));
+		else if (v >= INT8_MIN && v <= INT8_MAX) {
+			out.push_back('\xd0');
+			out.push_back(static_cast<char>(v));
+		} else if (v >= INT16_MIN && v <= INT16_MAX) {
+			out.push_back('\xd1');
+			msgpack_be(out, static_cast<uint16_t>(v));
+		} else if (v >= INT32_MIN && v <= INT32_MAX) {
+			out.push_back('\xd2');
+			msgpack_be(out, static_cast<uint32_t>(v));
+		} else {
+			out.push_back('\xd3');
+			msgpack_be(out, static_cast<uint64_t>(v));
+		}
+	}
+
+	inline void msgpack_double(std::string& out, double v) noexcept
+	{
+		out.push_back('\xcb');
+		msgpack_be(out, std::bit_cast<uint64_t>(v));
+	}
+
+	//header of a str, array or map, fix is the format of the small sizes and code the first of its 16 and 32 bit formats
+	inline void msgpack_header(std::string& out, size_t size, unsigned char fix, size_t fix_max, unsigned char code) noexcept
+	{
+		if (size <= fix_max)
+			out.push_back(static_cast<char>(fix | size));
+		else if (size <= UINT16_MAX) {
+			out.push_back(static_cast<char>(code));
+			msgpack_be(out, static_cast<uint16_t>(size));
+		} else {
+			out.push_back(static_cast<char>(code + 1));
+			msgpack_be(out, static_cast<uint32_t>(size));
+		}
+	}
+
+	inline void msgpack_str(std::string& out, std::string_view s) noexcept
+	{
+		if (s.size() > 31 && s.size() <= UINT8_MAX) {
+			out.push_back('\xd9');
+			out.push_back(static_cast<char>(s.size()));
+		} else
+			msgpack_header(out, s.size(), 0xa0, 31, 0xda);
+		out.append(s);
+	}
+
+	inline void msgpack_array(std::string& out, size_t size) noexcept
+	{
+		msgpack_header(out, size, 0x90, 15, 0xdc);
+	}
+
+	inline void msgpack_map(std::string& out, size_t size) noexcept
+	{
+		msgpack_header(out, size, 0x80, 15, 0xde);
+	}
+
+	template<typename T>
+	inline T load_binary(const char* data) noexcept
+	{
+		T value;
+		std::memcpy(&value, data, sizeof(T));
+		if constexpr (std::endian::native == std::endian::little)
+			value = std::byteswap(value);
+		return value;
+	}
+
+	//types whose binary format maps directly to a MessagePack value, other types are requested as text
+	inline bool is_simple_type(Oid type) noexcept
+	{
+		switch (type) {
+			case PG_BOOL: case PG_INT2: case PG_INT4: case PG_INT8: case PG_FLOAT4: case PG_FLOAT8: case PG_TEXT: case PG_VARCHAR:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	//numbers and booleans keep their type whether the column came in binary or text format, anything else is a str
+	inline void msgpack_value(std::string& out, PGresult* res, int row, int col) noexcept
+	{
+		if (PQgetisnull(res, row, col)) {
+			out.push_back('\xc0');
+			return;
+		}
+		const char* data {PQgetvalue(res, row, col)};
+		const std::string_view text {data, static_cast<size_t>(PQgetlength(res, row, col))};
+		const Oid type {PQftype(res, col)};
+		if (PQfformat(res, col) == 1) {
+			switch (type) {
+				case PG_BOOL: out.push_back(data[0] ? '\xc3' : '\xc2'); return;
+				case PG_INT2: msgpack_int(out, static_cast<int16_t>(load_binary<uint16_t>(data))); return;
+				case PG_INT4: msgpack_int(out, static_cast<int32_t>(load_binary<uint32_t>(data))); return;
+				case PG_INT8: msgpack_int(out, static_cast<int64_t>(load_binary<uint64_t>(data))); return;
+				case PG_FLOAT4: msgpack_double(out, std::bit_cast<float>(load_binary<uint32_t>(data))); return;
+				case PG_FLOAT8: msgpack_double(out, std::bit_cast<double>(load_binary<uint64_t>(data))); return;
+				default: msgpack_str(out, text); return;
+			}
+		}
+		switch (type) {
+			case PG_BOOL:
+				out.push_back(text == "t" ? '\xc3' : '\xc2');
+				return;
+			case PG_INT2: case PG_INT4: case PG_INT8:
+				if (int64_t v; parse_number(text, v)) {
+					msgpack_int(out, v);
+					return;
+				}
+				break;
+			case PG_FLOAT4: case PG_FLOAT8:
+				if (double v; parse_number(text, v)) {
+					msgpack_double(out, v);
+					return;
+				}
+				break;
 		}
-		return dbconns[dbname].conn;
+		msgpack_str(out, text);
 	}
 
+	//network byte order representation of the types sent in binary format, false sends the value as text
+	inline bool to_binary(Oid type, std::string_view value, std::array<char, 8>& out, int& length) noexcept
+	{
+		int64_t i {0};
+		double d {0};
+		switch (type) {
+			case PG_INT2:
+				if (!parse_number(value, i) || i < INT16_MIN || i > INT16_MAX)
+					return false;
+				store_binary(static_cast<uint16_t>(i), out, length);
+				return true;
+			case PG_INT4:
+				if (!parse_number(value, i) || i < INT32_MIN || i > INT32_MAX)
+					return false;
+				store_binary(static_cast<uint32_t>(i), out, length);
+				return true;
+			case PG_INT8:
+				if (!parse_number(value, i))
+					return false;
+				store_binary(static_cast<uint64_t>(i), out, length);
+				return true;
+			case PG_FLOAT4:
+				if (!parse_number(value, d))
+					return false;
+				store_binary(std::bit_cast<uint32_t>(static_cast<float>(d)), out, length);
+				return true;
+			case PG_FLOAT8:
+				if (!parse_number(value, d))
+					return false;
+				store_binary(std::bit_cast<uint64_t>(d), out, length);
+				return true;
+			case PG_DATE: { //days since 2000-01-01
+				int y {0};
+				unsigned m {0}, dd {0};
+				if (value.size() != 10 || value[4] != '-' || value[7] != '-' || !parse_number(value.substr(0, 4), y) 
+					|| !parse_number(value.substr(5, 2), m) || !parse_number(value.substr(8, 2), dd))
+					return false;
+				const std::chrono::year_month_day ymd {std::chrono::year{y}, std::chrono::month{m}, std::chrono::day{dd}};
+				if (!ymd.ok())
+					return false;
+				using namespace std::chrono_literals;
+				const auto days {(std::chrono::sys_days{ymd} - std::chrono::sys_days{2000y/std::chrono::January/1}).count()};
+				store_binary(static_cast<uint32_t>(days), out, length);
+				return true;
+			}
+			default:
+				return false;
+		}
+	}
+
+	//parameters of the statement being executed by this thread, the binary values are kept here
+	struct bound_params {
+		std::vector<const char*> values;
+		std::vector<int> lengths;
+		std::vector<int> formats;
+		std::vector<std::array<char, 8>> binary;
+	};
+	thread_local bound_params t_bound;
+
+	//0A000 (cached plan must not change result type) and 26000 (the statement does not exist on the server)
+	inline bool is_stale(const PGresult* res) noexcept
+	{
+		if (PQresultStatus(res) != PGRES_FATAL_ERROR)
+			return false;
+		const char* state {PQresultErrorField(res, PG_DIAG_SQLSTATE)};
+		return state && (std::string_view(state) == "0A000" || std::string_view(state) == "26000");
+	}
+
+	//the statement gets deallocated and prepared again the next time it is used on this connection
+	inline void set_stale(dbutil& db, const query& q, const PGresult* res) noexcept
+	{
+		if (!q.name || !is_stale(res))
+			return;
+		if (auto it = db.prepared.find(*q.name); it != db.prepared.end())
+			it->second.stale = true;
+	}
+
+	//prepares the statement on this connection the first time it is used there, returns the result of the step that failed or nullptr,
+	//if the server refuses it the statement runs as text on this connection from then on
+	inline PGresult* prepare(dbutil& db, const query& q, const statement_types*& types) noexcept
+	{
+		if (auto it = db.prepared.find(*q.name); it != db.prepared.end()) {
+			if (!it->second.stale) {
+				types = &it->second;
+				return nullptr;
+			}
+			logger::log(LOGGER_SRC, "warn", std::string(__FUNCTION__) + ": statement " + *q.name + " is stale, preparing it again", true);
+			db.prepared.erase(it);
+			PQclear(PQexec(db.conn, ("DEALLOCATE " + *q.name).c_str()));
+		}
+		PGresult* res {PQprepare(db.conn, q.name->c_str(), q.sql.c_str(), 0, nullptr)};
+		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+			if (!q.placeholders || PQstatus(db.conn) == CONNECTION_BAD)
+				return res;
+			logger::log(LOGGER_SRC, "warn", std::string(__FUNCTION__) + ": statement " + *q.name + " cannot be prepared, it runs as text on this connection - " 
+				+ get_error(db.conn), true);
+			PQclear(res);
+			statement_types st;
+			st.text = true;
+			types = &db.prepared.emplace(*q.name, std::move(st)).first->second;
+			return nullptr;
+		}
+		PQclear(res);
+		res = PQdescribePrepared(db.conn, q.name->c_str());
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			return res;
+		statement_types st {std::vector<Oid>(PQnparams(res)), std::vector<Oid>(PQnfields(res))};
+		for (size_t i = 0; i < st.params.size(); i++)
+			st.params[i] = PQparamtype(res, i);
+		for (size_t i = 0; i < st.columns.size(); i++)
+			st.columns[i] = PQftype(res, i);
+		PQclear(res);
+		types = &db.prepared.emplace(*q.name, std::move(st)).first->second;
+		return nullptr;
+	}
+
+	inline void bind(const query& q, const std::vector<Oid>& types) noexcept
+	{
+		const size_t n {q.values.size()};
+		t_bound.values.assign(q.values.begin(), q.values.end());
+		t_bound.lengths.assign(n, 0);
+		t_bound.formats.assign(n, 0);
+		t_bound.binary.resize(n);
+		for (size_t i = 0; i < n && i < types.size(); i++) {
+			if (q.values[i] && to_binary(types[i], q.values[i], t_bound.binary[i], t_bound.lengths[i])) {
+				t_bound.values[i] = t_bound.binary[i].data();
+				t_bound.formats[i] = 1;
+			}
+		}
+	}
+
+	//sql of the statement with every $n replaced by its value as a literal, nullptr is NULL,
+	//empty if a value cannot be escaped, so the server rejects it as an empty query
+	std::string splice(PGconn* conn, const query& q)
+	{
+		std::string sql;
+		sql.reserve(q.sql.size() + 16 * q.placeholders->size());
+		size_t pos {0};
+		for (const size_t offset: *q.placeholders) {
+			sql.append(q.sql, pos, offset - pos);
+			pos = offset + 1;
+			size_t index {0};
+			while (pos < q.sql.size() && std::isdigit(static_cast<unsigned char>(q.sql[pos])))
+				index = index * 10 + (q.sql[pos++] - '0');
+			const char* value {(index > 0 && index <= q.values.size()) ? q.values[index - 1] : nullptr};
+			if (!value) {
+				sql.append("NULL");
+				continue;
+			}
+			char* literal {PQescapeLiteral(conn, value, std::strlen(value))};
+			if (!literal)
+				return {};
+			sql.append(literal);
+			PQfreemem(literal);
+		}
+		sql.append(q.sql, pos);
+		return sql;
+	}
+
+	//PQexec for sql text, PQexecPrepared for a prepared statement,
+	//binary_results asks for the result in binary format if every column has a simple type,
+	//a stale statement is prepared again and executed once more
+	PGresult* execute(dbutil& db, const query& q, bool binary_results = false) noexcept
+	{
+		if (!q.name)
+			return PQexec(db.conn, q.sql.c_str());
+		for (int attempt = 0; ; attempt++) {
+			const statement_types* types {nullptr};
+			if (PGresult* res {prepare(db, q, types)})
+				return res;
+			if (types->text)
+				return PQexec(db.conn, splice(db.conn, q).c_str());
+			bind(q, types->params);
+			const bool binary {binary_results && std::ranges::all_of(types->columns, is_simple_type)};
+			PGresult* res {PQexecPrepared(db.conn, q.name->c_str(), t_bound.values.size(), t_bound.values.data(), 
+				t_bound.lengths.data(), t_bound.formats.data(), binary ? 1 : 0)};
+			if (attempt > 0 || !is_stale(res))
+				return res;
+			set_stale(db, q, res);
+			PQclear(res);
+		}
+	}
+
+	//asynchronous version of execute(), the error is left in the connection
+	bool send(dbutil& db, const query& q) noexcept
+	{
+		if (!q.name)
+			return PQsendQuery(db.conn, q.sql.c_str());
+		const statement_types* types {nullptr};
+		if (PGresult* res {prepare(db, q, types)}) {
+			PQclear(res);
+			return false;
+		}
+		//PQsendQueryParams because the simple query protocol is not allowed in pipeline mode
+		if (types->text)
+			return PQsendQueryParams(db.conn, splice(db.conn, q).c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0);
+		bind(q, types->params);
+		return PQsendQueryPrepared(db.conn, q.name->c_str(), t_bound.values.size(), t_bound.values.data(), 
+			t_bound.lengths.data(), t_bound.formats.data(), 0);
+	}
+
+
+	//single JSON value of the first column of the first row, the response of dbget_json
+	inline void get_json_value(std::string& json, PGresult* res) noexcept
+	{
+		if (PQntuples(res) && !PQgetisnull(res, 0, 0))
+			json.append("{\"status\":\"OK\", \"data\":").append(PQgetvalue(res, 0, 0)).append("}");
+		else
+			json.append("{\"status\":\"EMPTY\"}");
+	}
 
 	void reset(const std::string& dbname) noexcept
 	{
 		dbconns[dbname].reset_connection();
 	}
 
+	//closing the connection is the only way out of a pipeline that failed half-sent, the server rolls back what was not synced
+	inline void abort_pipeline(const std::string& dbname) noexcept
+	{
+		dbconns[dbname].reset_connection(true);
+	}
+
 	
-	void get_json(const std::string& dbname, std::string &json, const std::string &sql, bool useDataPrefix, const std::string &prefixName)
+	void get_json(const std::string& dbname, std::string &json, const query& sql, bool useDataPrefix, const std::string &prefixName)
 	{
 		int retries {0};
 		
 	retry:
-		PGconn *conn = getdb(dbname);
-		PGresult *res = PQexec(conn, sql.c_str());
+		dbutil& db {getdb(dbname)};
+		PGconn *conn = db.conn;
+		PGresult *res = execute(db, sql);
 		if (PQresultStatus(res) != PGRES_TUPLES_OK)
 		{
 			PQclear(res);
@@ -170,30 +570,20 @@ namespace sql
 		PQclear(res);
 	}
 	
-	void get_json(const std::string& dbname, std::string &json, const std::string &sql, const std::vector<std::string> &varNames, const std::string &prefixName) 
+	//one array per query, named by varNames
+	void get_json(const std::string& dbname, std::string &json, const std::vector<query>& queries, const std::vector<std::string> &varNames, const std::string &prefixName) 
 	{
 		int retries {0};
-		std::vector<std::string> qry;
-		size_t newpos{0};
-		while (true) {
-			if (auto pos = sql.find(";", newpos); pos != std::string::npos) {
-				qry.push_back(sql.substr(newpos, pos));
-				newpos = pos + 1;
-			} else {
-				if (newpos < sql.size())
-					qry.push_back(sql.substr(newpos));
-				break;
-			}
-		}
-		int i{0};
+		size_t i{0};
 		json.append( "{\"status\":\"OK\"," );
 		json.append("\"");
 		json.append(prefixName);
 		json.append("\":{");
-		for (auto& q: qry) {
+		for (auto& q: queries) {
 		  retry:
-			PGconn *conn = getdb(dbname);
-			PGresult *res = PQexec(conn, q.c_str());
+			dbutil& db {getdb(dbname)};
+			PGconn *conn = db.conn;
+			PGresult *res = execute(db, q);
 			if (PQresultStatus(res) != PGRES_TUPLES_OK)	{
 				PQclear(res);
 				if ( PQstatus(conn) == CONNECTION_BAD ) {
@@ -224,12 +614,154 @@ namespace sql
 		json.append("}}");
 	}	
 	
-	bool exec_sql(const std::string& dbname, const std::string& sql)
+	//fetch rows one at a time (single-row mode), flush() is called whenever the buffer reaches flush_size
+	//if flush() returns false the client is gone and the query gets cancelled
+	//errors detected before the first flush are reported in the buffer like get_json(), errors after that throw
+	void get_json_stream(const std::string& dbname, std::string &json, const query& sql, const std::function<bool(std::string&)>& flush, size_t flush_size, 
+		stream_format format)
 	{
 		int retries {0};
+
 	retry:
-		PGconn *conn = getdb(dbname);
-		PGresult *res = PQexec(conn, sql.c_str());
+		dbutil& db {getdb(dbname)};
+		PGconn *conn = db.conn;
+		if (!send(db, sql)) {
+			if ( PQstatus(conn) == CONNECTION_BAD ) {
+				if (retries == max_retries) {
+					logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": cannot connect to database", true);
+					json.append(DBLIB_ERROR);
+					return;
+				} else {
+					retries++;
+					reset(dbname);
+					goto retry;
+				}
+			} else {
+				logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+				json.append(DBLIB_ERROR);
+				return;
+			}
+		}
+		PQsetSingleRowMode(conn);
+
+		const bool ndjson {format == stream_format::ndjson};
+		const size_t start_pos {json.size()};
+		bool flushed {false};
+		bool first_row {true};
+		std::string error{""};
+		if (!ndjson)
+			json.append("{\"status\":\"OK\",\"data\":[");
+		while (PGresult *res = PQgetResult(conn)) {
+			switch (PQresultStatus(res)) {
+				case PGRES_SINGLE_TUPLE:
+					if (!first_row && !ndjson)
+						json.append(",");
+					first_row = false;
+					get_json_row(json, res, 0);
+					if (ndjson)
+						json.append("\n");
+					if (json.size() >= flush_size) {
+						flushed = true;
+						if (!flush(json)) {
+							PQclear(res);
+							cancel_query(conn);
+							throw std::runtime_error("client closed the connection while receiving rows");
+						}
+					}
+					break;
+				case PGRES_TUPLES_OK: //end of resultset
+					break;
+				default:
+					if (error.empty())
+						error = get_error(conn);
+					set_stale(db, sql, res);
+					break;
+			}
+			PQclear(res);
+		}
+
+		if (!error.empty()) {
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + error, true);
+			if (flushed || ndjson)
+				throw std::runtime_error("database error while streaming rows");
+			json.erase(start_pos);
+			json.append(DBLIB_ERROR);
+			return;
+		}
+		if (!ndjson)
+			json.append("]}");
+	}
+
+	//abort a running COPY TO, the rest of the data is discarded
+	inline void cancel_copy(PGconn* conn) noexcept
+	{
+		if (PGcancel* c = PQgetCancel(conn)) {
+			std::array<char, 256> errbuf{0};
+			PQcancel(c, errbuf.data(), errbuf.size());
+			PQfreeCancel(c);
+		}
+		char* buffer {nullptr};
+		while (PQgetCopyData(conn, &buffer, 0) > 0)
+			PQfreemem(buffer);
+		while (PGresult* res = PQgetResult(conn))
+			PQclear(res);
+	}
+
+	void copy_to(const std::string& dbname, std::string& out, std::string_view sql, std::string_view options, 
+		const std::function<bool(std::string&)>& flush, size_t flush_size)
+	{
+		//COPY takes a single statement and no parameters
+		while (!sql.empty() && (sql.back() == ';' || sql.back() == ' ' || sql.back() == '\t' || sql.back() == '\r' || sql.back() == '\n'))
+			sql.remove_suffix(1);
+		std::string copy {"COPY ("};
+		copy.append(sql).append(") TO STDOUT WITH (").append(options).append(")");
+
+		int retries {0};
+	retry:
+		dbutil& db {getdb(dbname)};
+		PGconn* conn {db.conn};
+		PGresult* res {PQexec(conn, copy.c_str())};
+		if (PQresultStatus(res) != PGRES_COPY_OUT) {
+			PQclear(res);
+			if ( PQstatus(conn) == CONNECTION_BAD && retries < max_retries ) {
+				retries++;
+				reset(dbname);
+				goto retry;
+			}
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+			throw std::runtime_error("database error while exporting rows");
+		}
+		PQclear(res);
+
+		char* buffer {nullptr};
+		int length {0};
+		while ((length = PQgetCopyData(conn, &buffer, 0)) > 0) {
+			out.append(buffer, length);
+			PQfreemem(buffer);
+			if (out.size() >= flush_size && !flush(out)) {
+				cancel_copy(conn);
+				throw std::runtime_error("client closed the connection while receiving rows");
+			}
+		}
+		bool failed {length == -2};
+		while ((res = PQgetResult(conn))) {
+			if (PQresultStatus(res) != PGRES_COMMAND_OK)
+				failed = true;
+			PQclear(res);
+		}
+		if (failed) {
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+			throw std::runtime_error("database error while exporting rows");
+		}
+	}
+
+	bool exec_sql(const std::string& dbname, const query& sql)
+	{
+		int retries {0};
+	retry:
+		dbutil& db {getdb(dbname)};
+		PGconn *conn = db.conn;
+		PGresult *res = execute(db, sql);
 		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
 			PQclear(res);
 			if ( PQstatus(conn) == CONNECTION_BAD ) {
@@ -251,13 +783,14 @@ namespace sql
 	}
 	
 	//returns true if the query retuned 1+ row
-	bool has_rows(const std::string& dbname, const std::string &sql)
+	bool has_rows(const std::string& dbname, const query& sql)
 	{
 		int retries {0};
 	
 	retry:
-		PGconn *conn = getdb(dbname);
-		PGresult *res = PQexec(conn, sql.c_str());
+		dbutil& db {getdb(dbname)};
+		PGconn *conn = db.conn;
+		PGresult *res = execute(db, sql);
 		
 		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
 			PQclear(res);
@@ -284,15 +817,16 @@ namespace sql
 	}	
 	
 	//returns only the first rows of a resultset, use of "limit 1" or "where col=pk" in the query is recommended
-	std::unordered_map<std::string, std::string> get_record(const std::string& dbname, const std::string& sql)
+	std::unordered_map<std::string, std::string> get_record(const std::string& dbname, const query& sql)
 	{
 		int retries {0};
 		std::unordered_map<std::string, std::string> rec;
 		rec.reserve(5);
 		
 	retry:
-		PGconn *conn = getdb(dbname);	
-		PGresult *res = PQexec(conn, sql.c_str());
+		dbutil& db {getdb(dbname)};
+		PGconn *conn = db.conn;
+		PGresult *res = execute(db, sql);
 		
 		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
 			PQclear(res);
@@ -318,7 +852,7 @@ namespace sql
 				rec.emplace(PQfname(res, j), PQgetvalue(res, 0, j));
 			}
 		} else {
-			logger::log(LOGGER_SRC, "warn", "get_record() resultset is empty: " + sql, true);
+			logger::log(LOGGER_SRC, "warn", "get_record() resultset is empty: " + sql.sql, true);
 		}
 		PQclear(res);
 		return rec;
@@ -326,13 +860,14 @@ namespace sql
 
 	//executes a query that returns JSON, the resultset should contain only one row with one column named json
 	//returns status EMPTY if: the resultset is empty (no rows) or the json column is NULL
-	void get_json_record(const std::string& dbname, std::string &json, const std::string &sql)
+	void get_json_record(const std::string& dbname, std::string &json, const query& sql)
 	{
 		int retries {0};
 		
 	retry:
-		PGconn *conn = getdb(dbname);	
-		PGresult *res = PQexec(conn, sql.c_str());
+		dbutil& db {getdb(dbname)};
+		PGconn *conn = db.conn;
+		PGresult *res = execute(db, sql);
 		
 		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
 			PQclear(res);
@@ -351,18 +886,309 @@ namespace sql
 			}
 		}
 	
-		int rows {PQntuples(res)};
-		bool is_null {0};
-		if (rows) {
-			is_null = PQgetisnull(res, 0, 0);
-			if (!is_null) {
-				json.append("{\"status\":\"OK\", \"data\":").append(PQgetvalue(res, 0, 0)).append("}");
+		get_json_value(json, res);
+		PQclear(res);
+	}
+
+	long long copy_from(const std::string& dbname, const std::string& sql, std::string_view data, std::string& sqlstate)
+	{
+		constexpr size_t copy_chunk_size {65536};
+		int retries {0};
+	retry:
+		dbutil& db {getdb(dbname)};
+		PGconn* conn {db.conn};
+		PGresult* res {PQexec(conn, sql.c_str())};
+		if (PQresultStatus(res) != PGRES_COPY_IN) {
+			if ( PQstatus(conn) == CONNECTION_BAD && retries < max_retries ) {
+				PQclear(res);
+				retries++;
+				reset(dbname);
+				goto retry;
+			}
+			if (const char* state {PQresultErrorField(res, PG_DIAG_SQLSTATE)})
+				sqlstate = state;
+			PQclear(res);
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+			return -1;
+		}
+		PQclear(res);
+
+		bool sent {true};
+		for (size_t pos = 0; pos < data.size() && sent; pos += copy_chunk_size) {
+			const std::string_view chunk {data.substr(pos, copy_chunk_size)};
+			sent = PQputCopyData(conn, chunk.data(), chunk.size()) == 1;
+		}
+		//the connection may still be in COPY IN state, only a new one is safe for the next query
+		if (PQputCopyEnd(conn, sent ? nullptr : "request body could not be sent") != 1) {
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+			db.reset_connection(true);
+			return -1;
+		}
+
+		long long rows {-1};
+		while ((res = PQgetResult(conn))) {
+			if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+				const std::string_view count {PQcmdTuples(res)};
+				rows = 0;
+				std::from_chars(count.data(), count.data() + count.size(), rows);
+			} else {
+				logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + PQresultErrorMessage(res), true);
+				if (const char* state {PQresultErrorField(res, PG_DIAG_SQLSTATE)})
+					sqlstate = state;
 			}
+			PQclear(res);
 		}
-		if (!rows || is_null) {
-			json.append("{\"status\":\"EMPTY\"}");
+		return rows;
+	}
+
+	void get_msgpack(const std::string& dbname, std::string& out, const query& sql)
+	{
+		int retries {0};
+	retry:
+		dbutil& db {getdb(dbname)};
+		PGconn* conn {db.conn};
+		PGresult* res {execute(db, sql, true)};
+		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+			PQclear(res);
+			if ( PQstatus(conn) == CONNECTION_BAD && retries < max_retries ) {
+				retries++;
+				reset(dbname);
+				goto retry;
+			}
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+			throw std::runtime_error("SQL database error");
+		}
+
+		const int rows {PQntuples(res)};
+		const int cols {PQnfields(res)};
+		msgpack_map(out, 3);
+		msgpack_str(out, "status");
+		msgpack_str(out, "OK");
+		msgpack_str(out, "columns");
+		msgpack_array(out, cols);
+		for (int j = 0; j < cols; j++)
+			msgpack_str(out, PQfname(res, j));
+		msgpack_str(out, "rows");
+		msgpack_array(out, rows);
+		for (int i = 0; i < rows; i++) {
+			msgpack_array(out, cols);
+			for (int j = 0; j < cols; j++)
+				msgpack_value(out, res, i, j);
 		}
 		PQclear(res);
 	}
+
+	bool exec_pipeline(const std::string& dbname, const std::vector<query>& queries, size_t& failed)
+	{
+		const size_t n {queries.size()};
+		failed = n;
+		dbutil& db {getdb(dbname)};
+		if (PQstatus(db.conn) == CONNECTION_BAD)
+			reset(dbname);
+		PGconn* conn {db.conn};
+
+		for (size_t i = 0; i < n; i++) {
+			const statement_types* types {nullptr};
+			if (queries[i].name) {
+				if (PGresult* res {prepare(db, queries[i], types)}) {
+					PQclear(res);
+					logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+					failed = i;
+					return false;
+				}
+			}
+		}
+
+		//no sync until the last query, so all of them form a single implicit transaction
+		if (!PQenterPipelineMode(conn)) {
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+			return false;
+		}
+		bool sent {true};
+		for (size_t i = 0; i < n && sent; i++)
+			sent = queries[i].name ? send(db, queries[i]) 
+				: PQsendQueryParams(conn, queries[i].sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0) == 1;
+		if (!sent || !PQpipelineSync(conn)) {
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+			abort_pipeline(dbname);
+			return false;
+		}
+
+		//a result and a null per query, the ones after a failure are PGRES_PIPELINE_ABORTED, then the sync
+		bool result {true};
+		size_t step {0};
+		int nulls {0};
+		while (true) {
+			PGresult* res {PQgetResult(conn)};
+			if (!res) {
+				if (++nulls == 2) {
+					logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+					abort_pipeline(dbname);
+					return false;
+				}
+				continue;
+			}
+			nulls = 0;
+			const ExecStatusType status {PQresultStatus(res)};
+			if (status == PGRES_PIPELINE_SYNC) {
+				PQclear(res);
+				break;
+			}
+			if (result && status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
+				logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + PQresultErrorMessage(res), true);
+				if (step < n)
+					set_stale(db, queries[step], res);
+				result = false;
+				failed = step;
+			}
+			PQclear(res);
+			step++;
+		}
+		if (!PQexitPipelineMode(conn))
+			abort_pipeline(dbname);
+		return result;
+	}
+
+	void get_json_pipeline(const std::string& dbname, const std::vector<query>& queries, const std::vector<bool>& records, std::vector<std::string>& results)
+	{
+		const size_t n {queries.size()};
+		results.assign(n, std::string());
+		dbutil& db {getdb(dbname)};
+		if (PQstatus(db.conn) == CONNECTION_BAD)
+			reset(dbname);
+		PGconn* conn {db.conn};
+
+		//PQprepare is synchronous and not allowed in pipeline mode
+		std::vector<bool> sent(n, false);
+		for (size_t i = 0; i < n; i++) {
+			const statement_types* types {nullptr};
+			if (queries[i].name) {
+				if (PGresult* res {prepare(db, queries[i], types)}) {
+					PQclear(res);
+					logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+					results[i] = DBLIB_ERROR;
+				}
+			}
+		}
+		
+		if (!PQenterPipelineMode(conn)) {
+			logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+			for (auto& r: results)
+				r = DBLIB_ERROR;
+			return;
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (!results[i].empty())
+				continue;
+			//the simple query protocol of PQsendQuery is not allowed in pipeline mode
+			const bool ok {queries[i].name ? send(db, queries[i]) 
+				: PQsendQueryParams(conn, queries[i].sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0) == 1};
+			if (ok && PQpipelineSync(conn))
+				sent[i] = true;
+			else {
+				logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+				results[i] = DBLIB_ERROR;
+			}
+		}
+
+		//each query returns its result, a null that ends it and the sync, two nulls in a row mean the connection failed
+		bool broken {false};
+		for (size_t i = 0; i < n; i++) {
+			if (!sent[i])
+				continue;
+			if (broken) {
+				results[i] = DBLIB_ERROR;
+				continue;
+			}
+			int nulls {0};
+			while (true) {
+				PGresult* res {PQgetResult(conn)};
+				if (!res) {
+					if (++nulls == 2) {
+						broken = true;
+						break;
+					}
+					continue;
+				}
+				nulls = 0;
+				const ExecStatusType status {PQresultStatus(res)};
+				if (status == PGRES_PIPELINE_SYNC) {
+					PQclear(res);
+					break;
+				}
+				if (status == PGRES_TUPLES_OK) {
+					if (records[i])
+						get_json_value(results[i], res);
+					else {
+						results[i].append("{\"status\":\"OK\",\"data\":");
+						get_json_array(results[i], res);
+						results[i].append("}");
+					}
+				} else {
+					logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+					set_stale(db, queries[i], res);
+					results[i] = DBLIB_ERROR;
+				}
+				PQclear(res);
+			}
+			if (broken) {
+				logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn), true);
+				results[i] = DBLIB_ERROR;
+			}
+		}
+		if (broken || !PQexitPipelineMode(conn))
+			abort_pipeline(dbname);
+	}
 	
+	inline bool subscribe(PGconn* conn, const std::vector<std::string>& channels) noexcept
+	{
+		for (const auto& channel: channels) {
+			char* id {PQescapeIdentifier(conn, channel.c_str(), channel.size())};
+			if (!id)
+				return false;
+			const std::string sql {"LISTEN " + std::string(id)};
+			PQfreemem(id);
+			PGresult* res {PQexec(conn, sql.c_str())};
+			const bool ok {PQresultStatus(res) == PGRES_COMMAND_OK};
+			PQclear(res);
+			if (!ok)
+				return false;
+		}
+		return true;
+	}
+
+	void listen(const std::string& conn_info, const std::vector<std::string>& channels, 
+		const std::function<void(const std::string&, const std::string&)>& notify, std::stop_token stop)
+	{
+		constexpr int poll_timeout_ms {1000}; //how often stop is checked
+		constexpr int retry_interval_ms {5000};
+		bool connected_before {false};
+		while (!stop.stop_requested()) {
+			PGconn* conn {PQconnectdb(conn_info.c_str())};
+			if (PQstatus(conn) == CONNECTION_OK && subscribe(conn, channels)) {
+				logger::log(LOGGER_SRC, "info", std::string(__FUNCTION__) + ": listening on " + std::to_string(channels.size()) + " channels of database " + PQdb(conn));
+				if (connected_before)
+					notify("", "");
+				connected_before = true;
+				while (!stop.stop_requested()) {
+					pollfd pfd {PQsocket(conn), POLLIN, 0};
+					const int rc {poll(&pfd, 1, poll_timeout_ms)};
+					if (rc == -1 && errno != EINTR)
+						break;
+					if (rc > 0 && !PQconsumeInput(conn))
+						break;
+					while (PGnotify* n = PQnotifies(conn)) {
+						notify(n->relname, n->extra);
+						PQfreemem(n);
+					}
+				}
+			}
+			if (!stop.stop_requested())
+				logger::log(LOGGER_SRC, "error", std::string(__FUNCTION__) + ": " + get_error(conn) + " - retrying in " + std::to_string(retry_interval_ms / 1000) + " seconds", true);
+			PQfinish(conn);
+			std::mutex mutex;
+			std::unique_lock lock {mutex};
+			std::condition_variable_any().wait_for(lock, stop, std::chrono::milliseconds(retry_interval_ms), [] { return false; });
+		}
+	}
 }
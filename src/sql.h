@@ -14,18 +14,65 @@
 #include <iostream>
 #include <unordered_map>
 #include <vector>
+#include <array>
+#include <functional>
+#include <algorithm>
+#include <stop_token>
+#include <condition_variable>
+#include <thread>
+#include <poll.h>
+#include <chrono>
+#include <bit>
+#include <charconv>
+#include <cstring>
 #include <libpq-fe.h>
 #include "logger.h"
 
 namespace sql
 {
+	//plain sql text, or a statement with $1..$n placeholders that is prepared on each connection the first time it runs there,
+	//the parameters of type smallint, integer, bigint, real, double precision and date are sent in binary format
+	struct query {
+		const std::string& sql;
+		const std::string* name {nullptr}; //prepared statement, nullptr for sql text
+		std::vector<const char*> values; //parameter values in text format, nullptr is NULL
+		const std::vector<size_t>* placeholders {nullptr}; //offset of each $n in sql, used when the statement cannot be prepared
+		query(const std::string& text): sql{text} { }
+		query(const std::string& statement, const std::string& text, std::vector<const char*>&& params, const std::vector<size_t>* offsets = nullptr): 
+			sql{text}, name{&statement}, values{std::move(params)}, placeholders{offsets} { }
+	};
+
 	void connect(const std::string& dbname, const std::string& conn_info);
-	void get_json(const std::string& dbname, std::string &json, const std::string &sql, bool useDataPrefix=true, const std::string &prefixName="data");
-	void get_json(const std::string& dbname, std::string &json, const std::string &sql, const std::vector<std::string> &varNames, const std::string &prefixName="data");
-	bool exec_sql(const std::string& dbname, const std::string& sql);
-	bool has_rows(const std::string& dbname, const std::string &sql);
-	std::unordered_map<std::string, std::string> get_record(const std::string& dbname, const std::string& sql);
-	void get_json_record(const std::string& dbname, std::string &json, const std::string &sql);
+	void get_json(const std::string& dbname, std::string &json, const query& sql, bool useDataPrefix=true, const std::string &prefixName="data");
+	void get_json(const std::string& dbname, std::string &json, const std::vector<query>& queries, const std::vector<std::string> &varNames, const std::string &prefixName="data");
+	enum class stream_format { json, ndjson }; //ndjson: one object per line and no status wrapper
+	void get_json_stream(const std::string& dbname, std::string &json, const query& sql, const std::function<bool(std::string&)>& flush, size_t flush_size, 
+		stream_format format = stream_format::json);
+	//runs COPY (sql) TO STDOUT with the given options, the data is appended to out and passed to flush every flush_size bytes
+	void copy_to(const std::string& dbname, std::string& out, std::string_view sql, std::string_view options, 
+		const std::function<bool(std::string&)>& flush, size_t flush_size);
+	bool exec_sql(const std::string& dbname, const query& sql);
+	bool has_rows(const std::string& dbname, const query& sql);
+	std::unordered_map<std::string, std::string> get_record(const std::string& dbname, const query& sql);
+	void get_json_record(const std::string& dbname, std::string &json, const query& sql);
+	//MessagePack map {"status": "OK", "columns": [names], "rows": [[values], ...]}, the column names are sent once,
+	//numbers and booleans are native values and the rest strings, throws if the query fails
+	void get_msgpack(const std::string& dbname, std::string& out, const query& sql);
+	//runs a COPY ... FROM STDIN statement and sends data in chunks, returns the number of rows copied or -1 if it failed,
+	//sqlstate receives the SQLSTATE code of the error if PostgreSQL reported one
+	long long copy_from(const std::string& dbname, const std::string& sql, std::string_view data, std::string& sqlstate);
+	//runs the queries in one implicit transaction and one round trip using pipeline mode, if one fails the others are rolled back
+	//or skipped, failed is the index of that query, or queries.size() if the failure is not related to a single query,
+	//every query is sent before any result is read, callers must bound the list so it fits in the socket buffers
+	bool exec_pipeline(const std::string& dbname, const std::vector<query>& queries, size_t& failed);
+	//sends all the queries before reading any result using pipeline mode, one round trip for the whole list, each query runs
+	//in its own implicit transaction so one failure does not abort the others, results[i] receives the same JSON as get_json,
+	//or as get_json_record if records[i] is true
+	void get_json_pipeline(const std::string& dbname, const std::vector<query>& queries, const std::vector<bool>& records, std::vector<std::string>& results);
+	//LISTEN on channels with a dedicated connection until stop is requested, notify() receives the channel and the payload,
+	//it receives empty values when the connection is restored because notifications may have been lost meanwhile
+	void listen(const std::string& conn_info, const std::vector<std::string>& channels, 
+		const std::function<void(const std::string&, const std::string&)>& notify, std::stop_token stop);
 }
 
 #endif /* SQL_H_ */